@@ -0,0 +1,428 @@
+/*
+    Throughput benchmark of cleks on generated corpora (POSIX only).
+
+    Build and run from the repository root:
+        cc -O2 -o bench/bench bench/bench.c -lm -lpthread
+        ./bench/bench [-s <MB per corpus>] [-r <runs>] [-f text|json|csv]
+
+    The corpora are generated from fixed seeds, so results are comparable between commits.
+    Every benchmark runs in its own process so that the reported peak RSS belongs to it alone.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/* Allocation counting */
+
+static size_t bench_allocations = 0;
+static size_t bench_allocated_bytes = 0;
+
+static void* bench_malloc(size_t size)
+{
+    bench_allocations += 1;
+    bench_allocated_bytes += size;
+    return malloc(size);
+}
+
+static void* bench_calloc(size_t count, size_t size)
+{
+    bench_allocations += 1;
+    bench_allocated_bytes += count*size;
+    return calloc(count, size);
+}
+
+static void* bench_realloc(void *ptr, size_t size)
+{
+    bench_allocations += 1;
+    bench_allocated_bytes += size;
+    return realloc(ptr, size);
+}
+
+// every allocation of cleks goes through the counting functions
+// (object-like macros, as CleksAllocator has a realloc member)
+#define malloc bench_malloc
+#define calloc bench_calloc
+#define realloc bench_realloc
+#include "../cleks.h"
+#include "../templates/cleks_json_template.h"
+#include "../templates/cleks_brainfuck_template.h"
+#undef malloc
+#undef calloc
+#undef realloc
+
+/* DSL config of examples/custom.c */
+
+enum DslTokens{
+    DSL_LT,
+    DSL_GT,
+    DSL_EQ,
+    DSL_IF,
+    DSL_THEN,
+    DSL_LB,
+    DSL_RB,
+    DSL_PRINT
+};
+
+CleksTokenConfig DslTokenConfig[] = {
+    [DSL_LT] = {"Less-Than", "", '<'},
+    [DSL_GT] = {"Greater-Than", "", '>'},
+    [DSL_EQ] = {"Equals", "", '='},
+    [DSL_IF] = {"If", "if", '\0'},
+    [DSL_THEN] = {"Then", "then", '\0'},
+    [DSL_LB] = {"Left-Bracket", "", '('},
+    [DSL_RB] = {"Right-Bracket", "", ')'},
+    [DSL_PRINT] = {"Function-Print", "print", '\0'}
+};
+
+CleksComment DslComments[] = {
+    {"//", "\n"},
+    {"#", "\n"},
+    {"/*", "*/"}
+};
+
+CleksString DslStrings[] = {
+    {'"', '"'},
+    {'[', ']'}
+};
+
+CleksConfig DslConfig = {
+    .default_tokens = CleksDefaultTokenConfig,
+    .default_token_count = CLEKS_TOKEN_COUNT,
+    .custom_tokens = DslTokenConfig,
+    .custom_token_count = CLEKS_ARR_LEN(DslTokenConfig),
+    .whitespaces = " \n",
+    .strings = DslStrings,
+    .string_count = CLEKS_ARR_LEN(DslStrings),
+    .comments = DslComments,
+    .comment_count = CLEKS_ARR_LEN(DslComments),
+    .flags = CLEKS_FLAG_DEFAULT
+};
+
+/* Corpus generation */
+
+typedef struct{
+    char *data;
+    size_t size;
+    size_t capacity;
+    uint64_t state;   // the state of the random number generator
+} Corpus;
+
+static void corpus_append(Corpus *corpus, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+    if (corpus->size + n + 1 > corpus->capacity){
+        while (corpus->size + n + 1 > corpus->capacity) corpus->capacity = corpus->capacity > 0 ? corpus->capacity*2 : 4096;
+        corpus->data = (char*) realloc(corpus->data, corpus->capacity);
+        if (corpus->data == NULL){
+            fprintf(stderr, "Failed to allocate corpus!\n");
+            exit(1);
+        }
+    }
+    va_start(args, fmt);
+    vsnprintf(corpus->data + corpus->size, n + 1, fmt, args);
+    va_end(args);
+    corpus->size += n;
+}
+
+static uint64_t corpus_random(Corpus *corpus)
+{
+    // xorshift64
+    corpus->state ^= corpus->state << 13;
+    corpus->state ^= corpus->state >> 7;
+    corpus->state ^= corpus->state << 17;
+    return corpus->state;
+}
+
+static size_t corpus_range(Corpus *corpus, size_t min, size_t max)
+{
+    return min + corpus_random(corpus) % (max - min + 1);
+}
+
+static const char *corpus_words[] = {"lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing", "elit", "sed", "do", "eiusmod", "tempor"};
+
+static void corpus_text(Corpus *corpus, size_t words, bool escapes)
+{
+    for (size_t i=0; i<words; ++i){
+        const char *word = corpus_words[corpus_range(corpus, 0, CLEKS_ARR_LEN(corpus_words)-1)];
+        if (escapes && corpus_range(corpus, 0, 15) == 0) corpus_append(corpus, "%s\\\"%s\\\" ", word, word);
+        else corpus_append(corpus, i+1 < words ? "%s " : "%s", word);
+    }
+}
+
+static void generate_json_strings(Corpus *corpus, size_t size)
+{
+    corpus_append(corpus, "[\n");
+    for (size_t i=0; corpus->size < size; ++i){
+        corpus_append(corpus, "%s    {\"id\": \"%016llx\", \"name\": \"", i > 0 ? ",\n" : "", (unsigned long long) corpus_random(corpus));
+        corpus_text(corpus, corpus_range(corpus, 1, 3), false);
+        corpus_append(corpus, "\", \"text\": \"");
+        corpus_text(corpus, corpus_range(corpus, 5, 40), true);
+        corpus_append(corpus, "\"}");
+    }
+    corpus_append(corpus, "\n]\n");
+}
+
+static void generate_json_numbers(Corpus *corpus, size_t size)
+{
+    corpus_append(corpus, "[\n");
+    for (size_t i=0; corpus->size < size; ++i){
+        corpus_append(corpus, i > 0 ? ",\n    [" : "    [");
+        for (size_t j=0; j<16; ++j){
+            const char *sep = j > 0 ? ", " : "";
+            switch (corpus_range(corpus, 0, 3)){
+                case 0: corpus_append(corpus, "%s%llu", sep, (unsigned long long) corpus_range(corpus, 0, 1000000000)); break;
+                case 1: corpus_append(corpus, "%s-%llu", sep, (unsigned long long) corpus_range(corpus, 0, 100000)); break;
+                case 2: corpus_append(corpus, "%s%.6f", sep, (double) corpus_random(corpus) / (double) UINT64_MAX * 1000.0); break;
+                default: corpus_append(corpus, "%s%.3e", sep, (double) corpus_random(corpus) / (double) UINT64_MAX * 1e-5); break;
+            }
+        }
+        corpus_append(corpus, "]");
+    }
+    corpus_append(corpus, "\n]\n");
+}
+
+static void generate_json_nested(Corpus *corpus, size_t size)
+{
+    corpus_append(corpus, "[");
+    for (size_t i=0; corpus->size < size; ++i){
+        if (i > 0) corpus_append(corpus, ",");
+        size_t depth = corpus_range(corpus, 1, 64);
+        for (size_t d=0; d<depth; ++d) corpus_append(corpus, d % 2 == 0 ? "{\"k%zu\":" : "[", d);
+        corpus_append(corpus, corpus_range(corpus, 0, 1) ? "true" : "null");
+        for (size_t d=depth; d-- > 0;) corpus_append(corpus, d % 2 == 0 ? "}" : ",1]");
+    }
+    corpus_append(corpus, "]\n");
+}
+
+static void generate_brainfuck(Corpus *corpus, size_t size)
+{
+    static const char commands[] = "+-<>.,";
+    while (corpus->size < size){
+        switch (corpus_range(corpus, 0, 7)){
+            case 0: corpus_append(corpus, "["); break;
+            case 1: corpus_append(corpus, "]"); break;
+            case 2:{
+                // comment text between the commands
+                corpus_text(corpus, 1, false);
+                corpus_append(corpus, "\n");
+            } break;
+            default:{
+                size_t run = corpus_range(corpus, 1, 12);
+                char c = commands[corpus_range(corpus, 0, sizeof(commands)-2)];
+                for (size_t i=0; i<run; ++i) corpus_append(corpus, "%c", c);
+            } break;
+        }
+    }
+}
+
+static void generate_dsl(Corpus *corpus, size_t size)
+{
+    while (corpus->size < size){
+        corpus_append(corpus, "/* ");
+        corpus_text(corpus, corpus_range(corpus, 3, 20), false);
+        corpus_append(corpus, " */\nif(x%zu < %zu) then print(\"", corpus_range(corpus, 0, 99), corpus_range(corpus, 0, 1000));
+        corpus_text(corpus, corpus_range(corpus, 1, 6), false);
+        corpus_append(corpus, "\"[note %zu]) // ", corpus_range(corpus, 0, 99));
+        corpus_text(corpus, corpus_range(corpus, 2, 10), false);
+        corpus_append(corpus, "\n# ");
+        corpus_text(corpus, corpus_range(corpus, 2, 8), false);
+        corpus_append(corpus, "\ny%zu = %zu.%zu\n", corpus_range(corpus, 0, 99), corpus_range(corpus, 0, 100), corpus_range(corpus, 0, 99));
+    }
+}
+
+typedef struct{
+    const char *name;
+    void (*generate)(Corpus *corpus, size_t size);
+    CleksConfig *config;
+    uint64_t seed;
+} BenchCorpus;
+
+static BenchCorpus bench_corpora[] = {
+    {"json-strings", generate_json_strings, &JsonConfig, 0x9E3779B97F4A7C15ull},
+    {"json-numbers", generate_json_numbers, &JsonConfig, 0xD1B54A32D192ED03ull},
+    {"json-nested", generate_json_nested, &JsonConfig, 0x8CB92BA72F3D8DD7ull},
+    {"brainfuck", generate_brainfuck, &BrainfuckConfig, 0xABC98388FB8FAC03ull},
+    {"dsl", generate_dsl, &DslConfig, 0x94D049BB133111EBull}
+};
+
+/* Benchmarks */
+
+typedef enum{
+    BENCH_LEX,      // Cleks_lex, copying the token values
+    BENCH_SPANS,    // Cleks_lex with CLEKS_FLAG_SPANS
+    BENCH_LEXER,    // a reused CleksLexer
+    BENCH_TAPE,     // Cleks_lex with CLEKS_FLAG_SPANS and Cleks_json_tape, JSON corpora only
+    BENCH_MODE_COUNT
+} BenchMode;
+
+static const char *bench_mode_names[] = {"lex", "spans", "lexer", "tape"};
+
+typedef struct{
+    size_t bytes;
+    size_t tokens;
+    double seconds;          // the fastest run
+    size_t allocations;      // of the last run
+    size_t allocated_bytes;  // of the last run
+    long peak_rss_kb;
+    bool failed;
+} BenchResult;
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static BenchResult bench_run(BenchCorpus *bench_corpus, BenchMode mode, size_t size, size_t runs)
+{
+    BenchResult result = {0};
+    Corpus corpus = {.state=bench_corpus->seed};
+    bench_corpus->generate(&corpus, size);
+    result.bytes = corpus.size;
+    result.seconds = -1;
+
+    CleksConfig config = *bench_corpus->config;
+    if (mode == BENCH_SPANS || mode == BENCH_TAPE) config.flags |= CLEKS_FLAG_SPANS;
+    CleksCompiledConfig *compiled = mode == BENCH_LEXER ? Cleks_compile_config(config) : NULL;
+    CleksLexer *lexer = mode == BENCH_LEXER ? Cleks_create_lexer(compiled, 16, NULL) : NULL;
+    for (size_t run=0; run<runs; ++run){
+        bench_allocations = 0;
+        bench_allocated_bytes = 0;
+        double start = bench_now();
+        CleksTokens *tokens = mode == BENCH_LEXER ? Cleks_lexer_lex(lexer, corpus.data, corpus.size) : Cleks_lex(corpus.data, corpus.size, config);
+        CleksJsonTape *tape = NULL;
+        if (mode == BENCH_TAPE && tokens != NULL && (tape = Cleks_json_tape(tokens, NULL)) == NULL){
+            Cleks_free_tokens(tokens);
+            tokens = NULL;
+        }
+        double seconds = bench_now() - start;
+        result.allocations = bench_allocations;
+        result.allocated_bytes = bench_allocated_bytes;
+        if (tokens == NULL){
+            result.failed = true;
+            break;
+        }
+        result.tokens = tokens->size;
+        if (mode != BENCH_LEXER){
+            // freeing is part of the cost of a one-shot lex
+            start = bench_now();
+            Cleks_json_free_tape(tape);
+            Cleks_free_tokens(tokens);
+            seconds += bench_now() - start;
+        }
+        if (result.seconds < 0 || seconds < result.seconds) result.seconds = seconds;
+    }
+    Cleks_free_lexer(lexer);
+    Cleks_free_compiled_config(compiled);
+    free(corpus.data);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    result.peak_rss_kb = usage.ru_maxrss;
+    return result;
+}
+
+static BenchResult bench_run_isolated(BenchCorpus *bench_corpus, BenchMode mode, size_t size, size_t runs)
+{
+    BenchResult result = {.failed=true};
+    int fds[2];
+    if (pipe(fds) == -1) return bench_run(bench_corpus, mode, size, runs);
+    pid_t pid = fork();
+    if (pid == -1){
+        close(fds[0]);
+        close(fds[1]);
+        return bench_run(bench_corpus, mode, size, runs);
+    }
+    if (pid == 0){
+        close(fds[0]);
+        result = bench_run(bench_corpus, mode, size, runs);
+        ssize_t written = write(fds[1], &result, sizeof(result));
+        _exit(written == (ssize_t) sizeof(result) ? 0 : 1);
+    }
+    close(fds[1]);
+    if (read(fds[0], &result, sizeof(result)) != (ssize_t) sizeof(result)) result.failed = true;
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+    return result;
+}
+
+/* Reporting */
+
+typedef enum{
+    FORMAT_TEXT,
+    FORMAT_JSON,
+    FORMAT_CSV
+} BenchFormat;
+
+static void bench_report(BenchFormat format, const char *corpus, const char *mode, BenchResult *result, bool first)
+{
+    double mb_per_s = result->seconds > 0 ? result->bytes / result->seconds / 1e6 : 0;
+    double tokens_per_s = result->seconds > 0 ? result->tokens / result->seconds : 0;
+    double ns_per_token = result->tokens > 0 ? result->seconds*1e9 / result->tokens : 0;
+    switch (format){
+        case FORMAT_TEXT:{
+            if (first) printf("%-14s %-6s %10s %12s %10s %9s %9s %12s %12s %12s\n", "corpus", "mode", "MB", "tokens", "MB/s", "Mtok/s", "ns/tok", "allocations", "alloc MB", "peak RSS MB");
+            if (result->failed){
+                printf("%-14s %-6s failed\n", corpus, mode);
+                break;
+            }
+            printf("%-14s %-6s %10.2f %12zu %10.1f %9.2f %9.2f %12zu %12.2f %12.2f\n", corpus, mode, result->bytes/1e6, result->tokens, mb_per_s, tokens_per_s/1e6, ns_per_token, result->allocations, result->allocated_bytes/1e6, result->peak_rss_kb/1024.0);
+        } break;
+        case FORMAT_JSON:{
+            printf("%s\n    {\"corpus\": \"%s\", \"mode\": \"%s\", \"failed\": %s, \"bytes\": %zu, \"tokens\": %zu, \"seconds\": %.9f, \"mb_per_s\": %.3f, \"tokens_per_s\": %.1f, \"ns_per_token\": %.3f, \"allocations\": %zu, \"allocated_bytes\": %zu, \"peak_rss_kb\": %ld}", first ? "[" : ",", corpus, mode, result->failed ? "true" : "false", result->bytes, result->tokens, result->seconds, mb_per_s, tokens_per_s, ns_per_token, result->allocations, result->allocated_bytes, result->peak_rss_kb);
+        } break;
+        case FORMAT_CSV:{
+            if (first) printf("corpus,mode,failed,bytes,tokens,seconds,mb_per_s,tokens_per_s,ns_per_token,allocations,allocated_bytes,peak_rss_kb\n");
+            printf("%s,%s,%d,%zu,%zu,%.9f,%.3f,%.1f,%.3f,%zu,%zu,%ld\n", corpus, mode, result->failed ? 1 : 0, result->bytes, result->tokens, result->seconds, mb_per_s, tokens_per_s, ns_per_token, result->allocations, result->allocated_bytes, result->peak_rss_kb);
+        } break;
+    }
+    fflush(stdout);
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-s <MB per corpus>] [-r <runs>] [-f text|json|csv]\n", program);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    size_t size = 16*1000*1000;
+    size_t runs = 5;
+    BenchFormat format = FORMAT_TEXT;
+    for (int i=1; i<argc; ++i){
+        if (i+1 >= argc) usage(argv[0]);
+        if (strcmp(argv[i], "-s") == 0) size = (size_t) (atof(argv[++i])*1000*1000);
+        else if (strcmp(argv[i], "-r") == 0) runs = (size_t) atoi(argv[++i]);
+        else if (strcmp(argv[i], "-f") == 0){
+            const char *name = argv[++i];
+            if (strcmp(name, "text") == 0) format = FORMAT_TEXT;
+            else if (strcmp(name, "json") == 0) format = FORMAT_JSON;
+            else if (strcmp(name, "csv") == 0) format = FORMAT_CSV;
+            else usage(argv[0]);
+        }
+        else usage(argv[0]);
+    }
+    if (size == 0 || runs == 0) usage(argv[0]);
+
+    bool first = true;
+    for (size_t i=0; i<CLEKS_ARR_LEN(bench_corpora); ++i){
+        for (int mode=0; mode<BENCH_MODE_COUNT; ++mode){
+            if (mode == BENCH_TAPE && bench_corpora[i].config != &JsonConfig) continue;
+            BenchResult result = bench_run_isolated(&bench_corpora[i], (BenchMode) mode, size, runs);
+            bench_report(format, bench_corpora[i].name, bench_mode_names[mode], &result, first);
+            first = false;
+        }
+    }
+    if (format == FORMAT_JSON) printf("\n]\n");
+    return 0;
+}
@@ -20,11 +20,67 @@
 #include <stdbool.h>
 #include <ctype.h>
 #include <stdint.h>
+#include <errno.h>
+#include <math.h>
+#include <locale.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define CLEKS_HAS_UNISTD
+#define CLEKS_HAS_MMAP
+#endif
+
+// define CLEKS_NO_THREADS to lex serially in Cleks_lex_parallel
+#if defined(CLEKS_HAS_UNISTD) && !defined(CLEKS_NO_THREADS)
+#include <pthread.h>
+#define CLEKS_HAS_THREADS
+#endif
+
+// strtod parses numbers in the C locale of the calling thread where per-thread locales exist
+#if defined(CLEKS_HAS_UNISTD) && defined(LC_ALL_MASK)
+#define CLEKS_HAS_USELOCALE
+#endif
+
+// define CLEKS_NO_SIMD to only use the scalar scanning kernels
+#if !defined(CLEKS_NO_SIMD) && (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CLEKS_HAS_AVX2
+#ifdef __SSE2__
+#define CLEKS_HAS_SSE2
+#endif
+#endif
+
+// lexing statistics (see CleksStats), the timers imply the statistics
+#if defined(CLEKS_STATS_TIMERS) && !defined(CLEKS_STATS)
+#define CLEKS_STATS
+#endif
+#ifdef CLEKS_STATS_TIMERS
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define CLEKS_HAS_RDTSC
+#else
+#include <time.h>
+#endif
+#endif
 
 /* Lexing flags */
 #define CLEKS_FLAG_DEFAULT     0x0 // all default features enabled
 #define CLEKS_FLAG_NO_INTEGERS 0x1 // integers are not recognized by the lexer
 #define CLEKS_FLAG_NO_FLOATS   0x2 // floats are not recognized by the lexer
+#define CLEKS_FLAG_SPANS       0x4 // tokens reference the input buffer instead of copying their values
+#define CLEKS_FLAG_IGNORE_UNKNOWN 0x8 // words that are neither custom words nor numbers are skipped instead of lexed as CLEKS_WORD
+#define CLEKS_FLAG_VALIDATE_UTF8  0x10 // strings must be valid UTF-8, otherwise CLEKS_ERROR_INVALID_UTF8 is reported
+#define CLEKS_FLAG_JSON_ESCAPES   0x20 // strings only allow the escape sequences of JSON and decode \uXXXX (and surrogate pairs) to UTF-8
+
+/* Token flags */
+#define CLEKS_TOKEN_FLAG_NONE    0x0
+#define CLEKS_TOKEN_FLAG_ESCAPES 0x1 // the span of the token contains escape sequences
+#define CLEKS_TOKEN_FLAG_OVERFLOW 0x2 // the number does not fit into its value and was saturated
+#define CLEKS_TOKEN_FLAG_INTERNED 0x4 // the value is the shared copy of an intern table and symbol_id its id
+#define CLEKS_TOKEN_FLAG_UNICODE 0x8  // the span of the string contains \uXXXX escape sequences (see CLEKS_FLAG_JSON_ESCAPES)
 
 /* Default tokens */
 typedef enum{
@@ -40,6 +96,8 @@ typedef struct{
     char* print_string; // the string to print for Cleks_print_tokens
     char* word;         // the string defining a word, "" for non-words
     char  symbol;       // the character defining a symbol, '\0' non-symbols
+    char* long_symbol;  // the string defining a multi-character symbol (e.g. "<="), NULL for non-symbols
+    bool  coalesce;     // whether a run of the symbol is lexed as a single token, its length being the repeat count
 } CleksTokenConfig;
 
 static CleksTokenConfig CleksDefaultTokenConfig[] = {
@@ -75,31 +133,308 @@ typedef struct{
 } CleksConfig;    
 
 
+/* Memory */
+typedef struct{
+    void* (*alloc)(void *user, size_t size);
+    void* (*realloc)(void *user, void *ptr, size_t old_size, size_t new_size);
+    void  (*free)(void *user, void *ptr);
+    void *user;       // passed to every call
+} CleksAllocator;     // a zeroed allocator uses malloc, realloc and free
+
+typedef struct CleksArenaBlock{
+    struct CleksArenaBlock *next;
+    size_t size;
+    size_t used;
+    char data[];
+} CleksArenaBlock;
+
+typedef struct{
+    CleksAllocator allocator;   // the allocator for the blocks
+    CleksArenaBlock *blocks;
+    CleksArenaBlock *current;   // the block allocations are made from
+    size_t block_size;          // the minimum size of a block
+    void *last;                 // the most recent allocation, which can be grown in place
+} CleksArena;
+
+/* Interning */
+typedef struct{
+    const char *text;   // the shared copy of the text, terminated by '\0'
+    size_t length;
+    uint64_t hash;
+} CleksInterned;
+
+typedef struct{
+    CleksAllocator allocator;   // used for the table and the arena blocks
+    CleksArena arena;           // holds the texts
+    CleksInterned *items;       // the interned texts, indexed by their id
+    size_t size;
+    size_t capacity;
+    uint32_t *slots;            // open addressing hash table of the ids plus one, 0 for empty slots
+    size_t slot_capacity;       // the number of slots (a power of two)
+} CleksInternTable;
+
+/* Statistics */
+#ifdef CLEKS_STATS
+#ifndef CLEKS_STATS_MAX_TOKENS
+#define CLEKS_STATS_MAX_TOKENS 64 // the number of custom token types counted individually
+#endif
+
+typedef enum{
+    CLEKS_PHASE_STRING,   // lexing strings
+    CLEKS_PHASE_COMMENT,  // skipping comments
+    CLEKS_PHASE_WORD,     // lexing words, including CLEKS_PHASE_NUMBER
+    CLEKS_PHASE_NUMBER,   // classifying and parsing numbers
+    CLEKS_PHASE_COUNT
+} CleksPhase;
+
+typedef struct{
+    size_t bytes;             // the number of input bytes
+    size_t tokens;            // the number of emitted tokens
+    size_t token_counts[CLEKS_TOKEN_COUNT + CLEKS_STATS_MAX_TOKENS]; // the emitted tokens by type + CLEKS_TOKEN_COUNT
+    size_t other_tokens;      // the emitted custom tokens not fitting into token_counts
+    size_t string_bytes;      // including the delimeters
+    size_t comment_bytes;     // including the delimeters
+    size_t whitespace_bytes;
+    size_t escapes;           // the number of escape sequences within strings
+    size_t allocations;       // the allocations of token values and token buffers
+    size_t allocated_bytes;
+    size_t regrowths;         // the number of times the token buffer was grown
+    uint64_t cycles[CLEKS_PHASE_COUNT]; // the time spent per phase with CLEKS_STATS_TIMERS (TSC cycles on x86, nanoseconds otherwise)
+} CleksStats;
+
+#define CLEKS_STAT(stats, field, n) ((stats).field += (n))
+#else
+#define CLEKS_STAT(stats, field, n) ((void) (n))
+#endif // CLEKS_STATS
+
+#ifdef CLEKS_STATS_TIMERS
+static inline uint64_t cleks_cycles(void)
+{
+#ifdef CLEKS_HAS_RDTSC
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec*1000000000ull + (uint64_t) ts.tv_nsec;
+#endif // CLEKS_HAS_RDTSC
+}
+
+#define CLEKS_TIMER_START(timer) uint64_t timer = cleks_cycles()
+#define CLEKS_TIMER_STOP(stats, phase, timer) ((stats).cycles[phase] += cleks_cycles() - (timer))
+#else
+#define CLEKS_TIMER_START(timer) ((void) 0)
+#define CLEKS_TIMER_STOP(stats, phase, timer) ((void) 0)
+#endif // CLEKS_STATS_TIMERS
+
+/* Source locations */
+typedef struct{
+    size_t *line_starts;  // the offset of the first byte of each line
+    size_t line_count;    // the number of lines, 0 if the index was not built
+    CleksAllocator allocator;
+} CleksLineIndex;
+
+/* Errors */
+typedef enum{
+    CLEKS_OK = 0,
+    CLEKS_ERROR_ALLOCATION,       // an allocation failed
+    CLEKS_ERROR_UNCLOSED_STRING,  // the input ended within a string
+    CLEKS_ERROR_UNEXPECTED_TOKEN, // a token is not allowed at its position (see the JSON template)
+    CLEKS_ERROR_UNEXPECTED_END,   // the input ended before it was complete (see the JSON template)
+    CLEKS_ERROR_INVALID_UTF8,     // a string contains an invalid UTF-8 sequence (see CLEKS_FLAG_VALIDATE_UTF8)
+    CLEKS_ERROR_INVALID_ESCAPE,   // a string contains an invalid escape sequence (see CLEKS_FLAG_JSON_ESCAPES)
+    CLEKS_ERROR_INVALID_EDIT,     // an edit does not fit the tokens it is applied to (see Cleks_relex)
+    CLEKS_ERROR_COUNT
+} CleksErrorCode;
+
+typedef struct{
+    CleksErrorCode code;  // the first error, CLEKS_OK if there was none
+    size_t offset;        // the byte offset of the error in the input
+    size_t line;          // the line of the error, starting at 1
+    size_t column;        // the byte column of the error, starting at 1
+    size_t count;         // the number of errors, more than one only when recovering
+} CleksError;
+
 /* Output */
 typedef int CleksTokenType;
 typedef struct{
     CleksTokenType type;
-    char *value;
+    char *value;      // the owned value of default tokens, NULL for custom tokens and with CLEKS_FLAG_SPANS
+    size_t offset;    // the offset of the token's content in the input buffer
+    size_t length;    // the length of the token's content in the input buffer
+    uint8_t flags;    // CLEKS_TOKEN_FLAG_* mask
+    union{
+        int64_t int_value;   // the parsed value of CLEKS_INT tokens
+        double float_value;  // the parsed value of CLEKS_FLOAT tokens
+        int symbol_id;       // the id of interned CLEKS_WORD and CLEKS_STRING tokens (see CLEKS_TOKEN_FLAG_INTERNED)
+    };
 } CleksToken;
 
 typedef struct{
-    CleksToken **items;
+    CleksToken *items;
     size_t size;
     size_t capacity;
     CleksConfig config;
+    char *buffer;     // the lexed buffer, referenced by the token spans
+    size_t buffer_size;
+    size_t clean_size; // the length of the input lexed before the first error, buffer_size without errors
+    CleksErrorCode error_code; // the first error, CLEKS_OK without errors
+    size_t error_count;        // the number of errors
+    size_t error_end;  // the errors lie within [clean_size, error_end), SIZE_MAX if lexing stopped at the last one
+    void *mapping;    // the memory owned by the tokens for buffer (see Cleks_lex_file), NULL otherwise
+    size_t mapping_size;
+    CleksAllocator allocator;        // used for the tokens and items
+    CleksAllocator value_allocator;  // used for the token values
+    CleksLineIndex lines;            // the lines of buffer, built by the first Cleks_token_location
+#ifdef CLEKS_STATS
+    CleksStats stats;                // the statistics of lexing the tokens
+#endif // CLEKS_STATS
 } CleksTokens;
 
+/* Compiled configuration */
+
+#define CLEKS_MAX_SIMD_SET 8 // the maximum number of distinct whitespace characters for vectorized skipping
+
+/* Character classes of the compiled lexer */
+#define CLEKS_CLASS_NONE       0x0 // the character starts or continues a word
+#define CLEKS_CLASS_WHITESPACE 0x1 // the character is a whitespace
+#define CLEKS_CLASS_SYMBOL     0x2 // the character is a custom symbol
+#define CLEKS_CLASS_STRING     0x4 // the character opens a string
+#define CLEKS_CLASS_COMMENT    0x8 // the character is the first byte of a comment start delimeter
+#define CLEKS_CLASS_LONG_SYMBOL 0x10 // the character is the first byte of a multi-character symbol
+#define CLEKS_CLASS_COALESCE   0x20 // runs of the symbol character are lexed as a single token
+
+#define CLEKS_CLASS_WORD_END (CLEKS_CLASS_WHITESPACE | CLEKS_CLASS_SYMBOL | CLEKS_CLASS_STRING) // characters terminating a word
+
+typedef struct{
+    const char *start_del;
+    const char *end_del;
+    size_t start_len;
+    size_t end_len;
+} CleksCompiledComment;
+
+typedef struct{
+    uint8_t byte;       // the byte leading to this node
+    int value;          // the value of the key ending at this node, CLEKS_NOT_FOUND otherwise
+    uint32_t child;     // the first child, 0 if none
+    uint32_t sibling;   // the next child of the same parent, 0 if none
+} CleksTrieNode;
+
+/* A trie of byte strings dispatched by their first byte */
+typedef struct{
+    CleksTrieNode *nodes;   // nodes[0] is unused, so that 0 marks missing nodes
+    size_t size;
+    uint32_t roots[256];    // the node of each first byte
+} CleksTrie;
+
+typedef struct{
+    const char *word;   // NULL for empty slots
+    size_t length;
+    CleksTokenType type;
+} CleksKeyword;
+
+/* A CleksConfig compiled into byte-indexed lookup tables (see Cleks_compile_config) */
+typedef struct{
+    CleksConfig config;                // the config this was compiled from
+    uint8_t classes[256];              // the CLEKS_CLASS_* mask of each byte
+    CleksTokenType symbols[256];       // the custom token of each symbol byte
+    char string_ends[256];             // the end delimeter of each string opening byte
+    CleksCompiledComment *comments;    // the comments with precomputed delimeter lengths
+    size_t comment_count;
+    CleksKeyword *keywords;            // open addressing hash table of the custom words
+    size_t keyword_capacity;           // the number of slots in keywords (a power of two)
+    char whitespaces[CLEKS_MAX_SIMD_SET]; // the whitespace characters for the vectorized whitespace skipping
+    size_t whitespace_count;           // the number of whitespace characters, 0 if there are too many to vectorize
+    CleksTrie symbol_trie;             // the multi-character symbols, valued by their token
+    CleksTrie comment_trie;            // the comment start delimeters, valued by their comment index
+} CleksCompiledConfig;
+
+/* What lexing does when it encounters an error */
+typedef enum{
+    CLEKS_ON_ERROR_FREE,     // free all tokens and return NULL
+    CLEKS_ON_ERROR_PARTIAL,  // stop and return the tokens lexed before the error
+    CLEKS_ON_ERROR_RECOVER   // skip to the next line and continue lexing (allocation failures stop like CLEKS_ON_ERROR_PARTIAL)
+} CleksErrorPolicy;
+
 /* Internal lexing state*/
 typedef struct{
     char *buffer;
     size_t buffer_size;
     size_t index;
+    bool eof;         // whether the buffer holds the rest of the input
+    int comment;      // the comment being skipped across buffer boundaries, CLEKS_NOT_FOUND otherwise
+    size_t resume;    // after CLEKS_STEP_MORE, how far past index the scan of the token continues, 0 to start over
+    uint8_t resume_flags; // the token flags collected before that point
+    CleksAllocator *allocator; // used for the token values, NULL for malloc
+    CleksInternTable *interns; // interns the values of CLEKS_WORD and CLEKS_STRING tokens, NULL otherwise
+    CleksErrorCode error;      // the error of the last CLEKS_STEP_ERROR
+    size_t error_offset;       // the buffer index of that error
+#ifdef CLEKS_STATS
+    CleksStats stats;
+#endif // CLEKS_STATS
 } Clekser;
 
+/* Result of lexing a single step */
+typedef enum{
+    CLEKS_STEP_NONE,  // nothing was lexed
+    CLEKS_STEP_TOKEN, // a token was lexed
+    CLEKS_STEP_SKIP,  // whitespaces or a comment were skipped
+    CLEKS_STEP_MORE,  // the buffer ended within a token, more input is required
+    CLEKS_STEP_END,   // the end of the input was reached
+    CLEKS_STEP_ERROR  // lexing failed
+} CleksStep;
+
+/* Token visitor, returning non-zero stops lexing */
+typedef int (*CleksVisitFn)(CleksToken *token, const char *buffer, void *user);
+
+/* Streaming input */
+typedef size_t (*CleksReadFn)(void *user, char *buffer, size_t size); // reads up to size bytes into buffer, returns 0 at the end of the input
+
+typedef struct{
+    CleksCompiledConfig *compiled;
+    CleksReadFn read;
+    void *user;
+    char *buffer;
+    size_t capacity;
+    size_t chunk_size;  // the number of bytes requested per read
+    size_t base;        // the stream offset of buffer[0]
+    Clekser clekser;
+    bool failed;        // whether lexing failed
+    CleksError error;   // the reason lexing failed
+    size_t line;        // the line of buffer[0]
+    size_t line_start;  // the stream offset of the start of that line
+} CleksStream;
+
+/* Reusable lexer context */
+typedef struct{
+    CleksCompiledConfig *compiled;
+    CleksAllocator allocator;   // used for the context and the token buffer
+    CleksArena arena;           // holds the token values, rewound on every reset
+    CleksTokens tokens;         // the tokens of the most recent input
+    CleksErrorPolicy policy;    // what Cleks_lexer_lex does on an error, CLEKS_ON_ERROR_FREE by default
+    CleksError error;           // the error of the most recent input
+    CleksInternTable *interns;  // interns the values of CLEKS_WORD and CLEKS_STRING tokens when set, NULL by default
+} CleksLexer;
+
+/* Batch lexing (see Cleks_lex_batch) */
+typedef struct{
+    CleksTokens *tokens;      // the tokens of each input in input order, use Cleks_batch_tokens
+    CleksError *errors;       // the error of each input
+    size_t count;             // the number of inputs
+    CleksErrorPolicy policy;  // the policy the inputs were lexed with
+    CleksArena *arenas;       // the arena of each worker, holding the token buffers and values
+    size_t arena_count;
+} CleksBatch;
+
 /* Macros */
 
 #define CLEKS_NOT_FOUND -1
 #define CLEKS_TOKENS_RESIZE_FACTOR 2
+#define CLEKS_ARENA_BLOCK_SIZE (64*1024) // the default minimum size of a CleksArena block
+#define CLEKS_TOKENS_FORMAT_VERSION 2 // the version of the format of Cleks_tokens_serialize
+#define CLEKS_TOKENS_HEADER_SIZE 80   // the size of the header of serialized tokens
+#ifndef CLEKS_PARALLEL_MIN_CHUNK
+#define CLEKS_PARALLEL_MIN_CHUNK (64*1024) // the minimum number of bytes lexed by each thread of Cleks_lex_parallel
+#endif
 
 #define CLEKS_TOKEN_IS_VALID(token) ((token) != NULL && (token->type) >= -CLEKS_TOKEN_COUNT) // Checks whether a token is valid (does not check upper bound for custom tokens)
 #define CLEKS_TOKEN_IS_CUSTOM(token) ((token)->type >= 0) // Checks whether a token is custom
@@ -117,61 +452,363 @@ typedef struct{
 
 /* Function definitions and implementations */
 
-void cleks_print_token(CleksToken *token, CleksConfig config);
-static char* cleks_strndup(char *s, size_t n);
-static bool cleks_str_is_int(char *s);
-static bool cleks_str_is_float(char *s);
+void cleks_print_token(CleksToken *token, CleksConfig config, const char *buffer);
+static char* cleks_strndup(CleksAllocator *allocator, char *s, size_t n);
+static CleksTokenType cleks_parse_number(const char *s, size_t n, uint8_t config_flags, CleksToken *token);
+static size_t cleks_unescape(const char *src, size_t n, char *dst, size_t dst_size, bool unicode);
+static uint64_t cleks_hash(const char *s, size_t n);
+static uint64_t cleks_hash_input(const char *s, size_t n);
+static const char* cleks_find2(const char *p, const char *end, char a, char b);
+static const char* cleks_find2_ascii(const char *p, const char *end, char a, char b);
+static const char* cleks_skip_set(const char *p, const char *end, const char *set, size_t set_size);
+static const char* cleks_find_str(const char *p, const char *end, const char *needle, size_t n);
+static size_t cleks_find_all(const char *p, const char *end, char c, size_t base, size_t *out);
 
-CleksTokens* Cleks_create_tokens(size_t capacity, CleksConfig config)
+/* Memory */
+
+void* Cleks_alloc(CleksAllocator *allocator, size_t size)
+{
+    if (allocator == NULL || allocator->alloc == NULL) return malloc(size);
+    return allocator->alloc(allocator->user, size);
+}
+
+void* Cleks_realloc(CleksAllocator *allocator, void *ptr, size_t old_size, size_t new_size)
+{
+    if (allocator == NULL || allocator->realloc == NULL) return realloc(ptr, new_size);
+    return allocator->realloc(allocator->user, ptr, old_size, new_size);
+}
+
+void Cleks_free(CleksAllocator *allocator, void *ptr)
+{
+    if (ptr == NULL) return;
+    if (allocator == NULL || allocator->free == NULL) free(ptr);
+    else allocator->free(allocator->user, ptr);
+}
+
+void Cleks_init_arena(CleksArena *arena, size_t block_size, CleksAllocator *allocator)
+{
+    cleks_assert(arena != NULL, "Invalid arena!");
+    memset(arena, 0, sizeof(*arena));
+    if (allocator != NULL) arena->allocator = *allocator;
+    arena->block_size = block_size > 0 ? block_size : CLEKS_ARENA_BLOCK_SIZE;
+}
+
+void* Cleks_arena_alloc(CleksArena *arena, size_t size)
+{
+    size = (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+    // blocks are kept on reset, so try the following ones before allocating
+    while (arena->current != NULL && arena->current->size - arena->current->used < size){
+        if (arena->current->next == NULL) break;
+        arena->current = arena->current->next;
+    }
+    CleksArenaBlock *block = arena->current;
+    if (block == NULL || block->size - block->used < size){
+        size_t block_size = size > arena->block_size ? size : arena->block_size;
+        CleksArenaBlock *new_block = (CleksArenaBlock*) Cleks_alloc(&arena->allocator, sizeof(CleksArenaBlock) + block_size);
+        if (new_block == NULL) return NULL;
+        *new_block = (CleksArenaBlock){.next=NULL, .size=block_size, .used=0};
+        if (block == NULL) arena->blocks = new_block;
+        else{
+            // insert after the current block so that remaining empty blocks stay reachable
+            new_block->next = block->next;
+            block->next = new_block;
+        }
+        arena->current = block = new_block;
+    }
+    void *ptr = block->data + block->used;
+    block->used += size;
+    arena->last = ptr;
+    return ptr;
+}
+
+void Cleks_reset_arena(CleksArena *arena)
+{
+    for (CleksArenaBlock *block = arena->blocks; block != NULL; block = block->next){
+        block->used = 0;
+    }
+    arena->current = arena->blocks;
+    arena->last = NULL;
+}
+
+void Cleks_free_arena(CleksArena *arena)
+{
+    CleksArenaBlock *block = arena->blocks;
+    while (block != NULL){
+        CleksArenaBlock *next = block->next;
+        Cleks_free(&arena->allocator, block);
+        block = next;
+    }
+    arena->blocks = NULL;
+    arena->current = NULL;
+    arena->last = NULL;
+}
+
+static void* cleks_arena_alloc_fn(void *user, size_t size)
+{
+    return Cleks_arena_alloc((CleksArena*) user, size);
+}
+
+static void* cleks_arena_realloc_fn(void *user, void *ptr, size_t old_size, size_t new_size)
+{
+    CleksArena *arena = (CleksArena*) user;
+    if (ptr != NULL && ptr == arena->last){
+        // grow the most recent allocation in place
+        CleksArenaBlock *block = arena->current;
+        size_t offset = (char*) ptr - block->data;
+        size_t aligned = (new_size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+        if (block->size - offset >= aligned){
+            block->used = offset + aligned;
+            return ptr;
+        }
+    }
+    void *new_ptr = Cleks_arena_alloc(arena, new_size);
+    if (new_ptr != NULL && ptr != NULL) memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+    return new_ptr;
+}
+
+static void cleks_arena_free_fn(void *user, void *ptr)
+{
+    // arena memory is only released by Cleks_reset_arena and Cleks_free_arena
+    (void) user;
+    (void) ptr;
+}
+
+CleksAllocator Cleks_arena_allocator(CleksArena *arena)
+{
+    return (CleksAllocator){.alloc=cleks_arena_alloc_fn, .realloc=cleks_arena_realloc_fn, .free=cleks_arena_free_fn, .user=arena};
+}
+
+/* Interning */
+
+CleksInternTable* Cleks_create_intern_table(CleksAllocator *allocator)
+{
+    CleksInternTable *table = (CleksInternTable*) Cleks_alloc(allocator, sizeof(*table));
+    if (table == NULL) return NULL;
+    memset(table, 0, sizeof(*table));
+    if (allocator != NULL) table->allocator = *allocator;
+    Cleks_init_arena(&table->arena, 0, &table->allocator);
+    return table;
+}
+
+static bool cleks_grow_intern_slots(CleksInternTable *table)
+{
+    size_t capacity = table->slot_capacity > 0 ? table->slot_capacity*2 : 64;
+    uint32_t *slots = (uint32_t*) Cleks_alloc(&table->allocator, capacity*sizeof(uint32_t));
+    if (slots == NULL) return false;
+    memset(slots, 0, capacity*sizeof(uint32_t));
+    // the hashes are kept with the texts, so nothing is hashed again
+    for (size_t id=0; id<table->size; ++id){
+        size_t slot = table->items[id].hash & (capacity-1);
+        while (slots[slot] != 0) slot = (slot+1) & (capacity-1);
+        slots[slot] = (uint32_t) id + 1;
+    }
+    Cleks_free(&table->allocator, table->slots);
+    table->slots = slots;
+    table->slot_capacity = capacity;
+    return true;
+}
+
+int Cleks_intern(CleksInternTable *table, const char *text, size_t length)
+{
+    cleks_assert(table != NULL && (text != NULL || length == 0), "Invalid arguments: table=%p, text=%p", table, text);
+    uint64_t hash = cleks_hash(text, length);
+    size_t slot = 0;
+    if (table->slot_capacity > 0){
+        slot = hash & (table->slot_capacity-1);
+        for (uint32_t id; (id = table->slots[slot]) != 0; slot = (slot+1) & (table->slot_capacity-1)){
+            CleksInterned *interned = &table->items[id-1];
+            if (interned->hash == hash && interned->length == length && memcmp(interned->text, text, length) == 0) return (int) id - 1;
+        }
+    }
+    if (table->size >= INT32_MAX) return CLEKS_NOT_FOUND;
+    // keep the load factor of the slots at or below 50%
+    if ((table->size+1)*2 > table->slot_capacity){
+        if (!cleks_grow_intern_slots(table)) return CLEKS_NOT_FOUND;
+        slot = hash & (table->slot_capacity-1);
+        while (table->slots[slot] != 0) slot = (slot+1) & (table->slot_capacity-1);
+    }
+    if (table->size >= table->capacity){
+        size_t new_capacity = table->capacity > 0 ? table->capacity*2 : 32;
+        CleksInterned *new_items = (CleksInterned*) Cleks_realloc(&table->allocator, table->items, table->capacity*sizeof(CleksInterned), new_capacity*sizeof(CleksInterned));
+        if (new_items == NULL) return CLEKS_NOT_FOUND;
+        table->items = new_items;
+        table->capacity = new_capacity;
+    }
+    char *copy = (char*) Cleks_arena_alloc(&table->arena, length+1);
+    if (copy == NULL) return CLEKS_NOT_FOUND;
+    if (length > 0) memcpy(copy, text, length);
+    copy[length] = '\0';
+    table->items[table->size] = (CleksInterned){.text=copy, .length=length, .hash=hash};
+    table->slots[slot] = (uint32_t) table->size + 1;
+    return (int) table->size++;
+}
+
+const char* Cleks_intern_text(CleksInternTable *table, int id)
+{
+    if (table == NULL || id < 0 || (size_t) id >= table->size) return NULL;
+    return table->items[id].text;
+}
+
+void Cleks_free_intern_table(CleksInternTable *table)
+{
+    if (table == NULL) return;
+    CleksAllocator allocator = table->allocator;
+    Cleks_free(&allocator, table->items);
+    Cleks_free(&allocator, table->slots);
+    Cleks_free_arena(&table->arena);
+    Cleks_free(&allocator, table);
+}
+
+/* Tokens */
+
+static bool cleks_init_tokens(CleksTokens *tokens, size_t capacity, CleksConfig config, CleksAllocator *allocator)
 {
-    CleksTokens *tokens = (CleksTokens*) calloc(1, sizeof(*tokens));
-    cleks_assert(tokens != NULL, "Failed to allocate CleksTokens!");
-    tokens->items = (CleksToken**) calloc(capacity, sizeof(CleksToken*));
-    if (tokens->items == NULL){
-        free(tokens);
-        cleks_error("Failed to allocate CleksTokens items!");
-        exit(1);
+    memset(tokens, 0, sizeof(*tokens));
+    if (allocator != NULL){
+        tokens->allocator = *allocator;
+        tokens->value_allocator = *allocator;
     }
+    if (capacity == 0) capacity = 1;
+    tokens->items = (CleksToken*) Cleks_alloc(&tokens->allocator, capacity*sizeof(CleksToken));
+    if (tokens->items == NULL) return false;
+    CLEKS_STAT(tokens->stats, allocations, 1);
+    CLEKS_STAT(tokens->stats, allocated_bytes, capacity*sizeof(CleksToken));
     tokens->capacity = capacity;
     memcpy(&tokens->config, &config, sizeof(CleksConfig));
+    return true;
+}
+
+CleksTokens* Cleks_create_tokens_with(size_t capacity, CleksConfig config, CleksAllocator *allocator)
+{
+    CleksTokens *tokens = (CleksTokens*) Cleks_alloc(allocator, sizeof(*tokens));
+    if (tokens == NULL) return NULL;
+    if (!cleks_init_tokens(tokens, capacity, config, allocator)){
+        Cleks_free(allocator, tokens);
+        return NULL;
+    }
     return tokens;
 }
 
+CleksTokens* Cleks_create_tokens(size_t capacity, CleksConfig config)
+{
+    return Cleks_create_tokens_with(capacity, config, NULL);
+}
+
+void Cleks_free_line_index(CleksLineIndex *index);
+
+static void cleks_free_token_value(CleksTokens *tokens, CleksToken *token)
+{
+    // interned values belong to their intern table
+    if (token->flags & CLEKS_TOKEN_FLAG_INTERNED) return;
+    Cleks_free(&tokens->value_allocator, token->value);
+}
+
+static void cleks_unmap_file(void *mapping, size_t size);
+
+static void cleks_release_mapping(CleksTokens *tokens)
+{
+    cleks_unmap_file(tokens->mapping, tokens->mapping_size);
+    tokens->mapping = NULL;
+}
+
+static void cleks_clear_tokens(CleksTokens *tokens)
+{
+    for (size_t i=0; i<tokens->size; ++i) cleks_free_token_value(tokens, &tokens->items[i]);
+    tokens->size = 0;
+    Cleks_free_line_index(&tokens->lines);
+    cleks_release_mapping(tokens);
+}
+
 void Cleks_free_tokens(CleksTokens *tokens)
 {
     if (tokens != NULL){
         if (tokens->items != NULL){
-            for (size_t i=0; i<tokens->size; ++i){
-                CleksToken *token = tokens->items[i];
-                if (token != NULL){
-                    free(token->value);
-                    free(token);
-                }
-            }
-            free(tokens->items);
+            cleks_clear_tokens(tokens);
+            Cleks_free(&tokens->allocator, tokens->items);
+        }
+        else if (tokens->mapping != NULL){
+            cleks_clear_tokens(tokens);
         }
-        free(tokens);
+        CleksAllocator allocator = tokens->allocator;
+        Cleks_free(&allocator, tokens);
     }
 }
 
-void Cleks_append_token(CleksTokens *tokens, CleksTokenType token_type, char *token_value)
+CleksToken* Cleks_append_token(CleksTokens *tokens, CleksTokenType token_type, char *token_value)
 {
     if (!tokens){
         cleks_error("Invalid CleksTokens pointer!");
-        exit(1);
+        return NULL;
     } 
     if (tokens->size >= tokens->capacity){
         size_t new_capacity = tokens->capacity * CLEKS_TOKENS_RESIZE_FACTOR;
-        CleksToken **new_items = (CleksToken**) realloc(tokens->items, new_capacity*sizeof(CleksToken*));
-        cleks_assert(new_items != NULL, "Failed to resize CleksTokens!");
+        CleksToken *new_items = (CleksToken*) Cleks_realloc(&tokens->allocator, tokens->items, tokens->capacity*sizeof(CleksToken), new_capacity*sizeof(CleksToken));
+        if (new_items == NULL) return NULL;
+        CLEKS_STAT(tokens->stats, regrowths, 1);
+        CLEKS_STAT(tokens->stats, allocations, 1);
+        CLEKS_STAT(tokens->stats, allocated_bytes, new_capacity*sizeof(CleksToken));
         tokens->items = new_items;
         tokens->capacity = new_capacity;
     }
-    CleksToken *token = calloc(1, sizeof(CleksToken));
-    cleks_assert(token != NULL, "Failed to allocate new CleksToken!");
+    CleksToken *token = &tokens->items[tokens->size++];
     token->type = token_type;
-    token->value = token_value; 
-    tokens->items[tokens->size++] = token;
+    token->value = token_value;
+    token->offset = 0;
+    token->length = 0;
+    token->flags = CLEKS_TOKEN_FLAG_NONE;
+    return token;
+}
+
+static bool cleks_push_token(CleksTokens *tokens, CleksToken *token)
+{
+    CleksToken *slot = Cleks_append_token(tokens, token->type, token->value);
+    if (slot == NULL){
+        if ((token->flags & CLEKS_TOKEN_FLAG_INTERNED) == 0) Cleks_free(&tokens->value_allocator, token->value);
+        return false;
+    }
+    *slot = *token;
+    return true;
+}
+
+static size_t cleks_token_start(CleksToken *token)
+{
+    // strings record the span of their content
+    return token->type == CLEKS_STRING ? token->offset - 1 : token->offset;
+}
+
+static size_t cleks_token_end(CleksToken *token)
+{
+    return token->type == CLEKS_STRING ? token->offset + token->length + 1 : token->offset + token->length;
+}
+
+size_t Cleks_token_unescape(const char *buffer, CleksToken *token, char *out, size_t out_size)
+{
+    if (token == NULL) return 0;
+    if (token->value != NULL){
+        size_t length = strlen(token->value);
+        if (out != NULL && out_size > 0){
+            size_t n = length < out_size ? length : out_size-1;
+            memcpy(out, token->value, n);
+            out[n] = '\0';
+        }
+        return length;
+    }
+    if (buffer == NULL) return 0;
+    if (token->flags & CLEKS_TOKEN_FLAG_ESCAPES){
+        return cleks_unescape(buffer + token->offset, token->length, out, out_size, token->flags & CLEKS_TOKEN_FLAG_UNICODE);
+    }
+    if (out != NULL && out_size > 0){
+        size_t n = token->length < out_size ? token->length : out_size-1;
+        memcpy(out, buffer + token->offset, n);
+        out[n] = '\0';
+    }
+    return token->length;
+}
+
+CleksToken* Cleks_get_token(CleksTokens *tokens, size_t index)
+{
+    if (tokens == NULL || index >= tokens->size) return NULL;
+    return &tokens->items[index];
 }
 
 int Cleks_char_to_token(char c, CleksTokenConfig *tokens, size_t size)
@@ -192,244 +829,2935 @@ int Cleks_char_in_string_dels(char c, CleksString *string_dels, size_t size)
 
 int Cleks_char_in_string(char c, const char *array)
 {
-    for (size_t i=0; i<strlen(array); ++i){
-        if (c == array[i]) return 0;
+    for (; *array != '\0'; ++array){
+        if (c == *array) return 0;
     }
     return 1;
 }
 
-int Cleks_lex_word(Clekser *clekser, CleksTokens *tokens, CleksConfig config)
+void Cleks_free_compiled_config(CleksCompiledConfig *compiled);
+
+static bool cleks_init_trie(CleksTrie *trie, size_t capacity)
 {
-    cleks_assert(clekser != NULL && tokens != NULL, "Invalid Arguments: clekser=%p, tokens=%p", clekser, tokens);
-    size_t word_start = clekser->index;
-    while (clekser->index < clekser->buffer_size){
-        char c = clekser->buffer[clekser->index];
-        if (Cleks_char_in_string_dels(c, config.strings, config.string_count)==0 || Cleks_char_in_string(c, config.whitespaces)==0 || Cleks_char_to_token(c, config.custom_tokens, config.custom_token_count) != CLEKS_NOT_FOUND) break;
-        clekser->index += 1;
-    }
-    for (size_t i=0; i<config.custom_token_count; ++i){
-        if (strncmp(clekser->buffer + word_start, config.custom_tokens[i].word, clekser->index - word_start) == 0){
-            // words match
-            Cleks_append_token(tokens, (CleksTokenType) i, NULL);
-            return 0;
-        }
-    }
-    char *word_value = cleks_strndup(clekser->buffer + word_start, clekser->index - word_start);
-    if (word_value == NULL){
-        cleks_error("Failed to allocate word value!");
-        return 1;
-    }
-    if ((config.flags & CLEKS_FLAG_NO_INTEGERS) == 0 && cleks_str_is_int(word_value)){
-        Cleks_append_token(tokens, CLEKS_INT, word_value);
-        return 0;
-    }
-    else if ((config.flags & CLEKS_FLAG_NO_FLOATS) == 0 && cleks_str_is_float(word_value)){
-        Cleks_append_token(tokens, CLEKS_FLOAT, word_value);
-        return 0;
-    }
-    Cleks_append_token(tokens, CLEKS_WORD, word_value);
-    return 0;
+    // at most one node per byte of all keys, node 0 is never used
+    trie->nodes = (CleksTrieNode*) calloc(capacity, sizeof(CleksTrieNode));
+    trie->size = 1;
+    return trie->nodes != NULL;
 }
 
-int Cleks_lex_string(Clekser *clekser, CleksTokens *tokens, CleksConfig config, char str_end_del)
+// inserts a key unless it is already present or, with prefixes_win, has a prefix in the trie
+static void cleks_trie_insert(CleksTrie *trie, const char *key, size_t length, int value, bool prefixes_win)
 {
-    cleks_assert(clekser != NULL && tokens != NULL, "Invalid Arguments: clekser=%p, tokens=%p", clekser, tokens);
-    size_t str_start = clekser->index;
-    char c;
-    while (clekser->index < clekser->buffer_size){
-        c = clekser->buffer[++(clekser->index)];
-        cleks_assert(c != '\0', "[PARSING] Unclosed string delimeters at index %u!", str_start);
-        if (c == str_end_del) break;
-    }
-
-    size_t str_len = clekser->index - str_start;
-    char *str_value = (char*) calloc(str_len+1, sizeof(char));
-    if (str_value == NULL){
-        cleks_error("Failed to allocate string value!");
-        return 1;
+    uint8_t first = (uint8_t) key[0];
+    if (trie->roots[first] == 0){
+        trie->nodes[trie->size] = (CleksTrieNode){.byte=first, .value=CLEKS_NOT_FOUND};
+        trie->roots[first] = (uint32_t) trie->size++;
     }
-    
-    // handle escape codes
-    char *buff_start = clekser->buffer + str_start;
-    char *iB = buff_start;
-    char *iS = str_value;
-    while (iB - buff_start < str_len){
-        if (*iB == '\\'){
-            switch(*++iB){
-                case '\'': *iS = 0x27; break;
-                case '"':  *iS = 0x22; break;
-                case '?':  *iS = 0x3f; break;
-                case '\\': *iS = 0x5c; break;
-                case 'a':  *iS = 0x07; break;
-                case 'b':  *iS = 0x08; break;
-                case 'f':  *iS = 0x0c; break;
-                case 'n':  *iS = 0x0a; break;
-                case 'r':  *iS = 0x0d; break;
-                case 't':  *iS = 0x09; break;
-                case 'v':  *iS = 0x0b; break;
-            }
-        }
-        else{
-            *iS = *iB;
+    uint32_t node = trie->roots[first];
+    for (size_t i=1; i<length; ++i){
+        if (prefixes_win && trie->nodes[node].value != CLEKS_NOT_FOUND) return;
+        uint32_t child = trie->nodes[node].child;
+        while (child != 0 && trie->nodes[child].byte != (uint8_t) key[i]) child = trie->nodes[child].sibling;
+        if (child == 0){
+            child = (uint32_t) trie->size++;
+            trie->nodes[child] = (CleksTrieNode){.byte=(uint8_t) key[i], .value=CLEKS_NOT_FOUND, .child=0, .sibling=trie->nodes[node].child};
+            trie->nodes[node].child = child;
         }
-        iB++;   
-        iS++;
+        node = child;
     }
-    Cleks_append_token(tokens, CLEKS_STRING, str_value);
-    return 0;
+    // earlier definitions take precedence over duplicates
+    if (trie->nodes[node].value == CLEKS_NOT_FOUND) trie->nodes[node].value = value;
 }
 
-int Cleks_lex_comment(Clekser *clekser, CleksConfig config)
+CleksCompiledConfig* Cleks_compile_config(CleksConfig config)
 {
-    cleks_assert(clekser != NULL, "Invalid arguments: clekser: %p!", clekser);
-    for (size_t i=0; i<config.comment_count; ++i){
-        const char *start_del = config.comments[i].start_del;
-        bool equals = true;
-        size_t temp_index = clekser->index;
-        for (size_t j=0; j<strlen(start_del); ++j, ++temp_index){
-            if (clekser->buffer[temp_index] != start_del[j]){
-                equals = false;
-                break;
+    CleksCompiledConfig *compiled = (CleksCompiledConfig*) calloc(1, sizeof(*compiled));
+    if (compiled == NULL){
+        cleks_error("Failed to allocate CleksCompiledConfig!");
+        return NULL;
+    }
+    memcpy(&compiled->config, &config, sizeof(CleksConfig));
+    // later definitions have a lower priority, therefore go through them in reverse
+    if (config.whitespaces != NULL){
+        for (const char *ws = config.whitespaces; *ws != '\0'; ++ws){
+            if (compiled->classes[(uint8_t) *ws] & CLEKS_CLASS_WHITESPACE) continue;
+            compiled->classes[(uint8_t) *ws] |= CLEKS_CLASS_WHITESPACE;
+            if (compiled->whitespace_count < CLEKS_MAX_SIMD_SET){
+                compiled->whitespaces[compiled->whitespace_count] = *ws;
             }
+            compiled->whitespace_count += 1;
         }
-        // skip until end_del
-        if (!equals) continue;
-        const char* end_del = config.comments[i].end_del;
-        size_t del_size = strlen(end_del);
-        while (temp_index < clekser->buffer_size){
-            bool matches = true;
-            for (size_t j=0; j<del_size; ++j){
-                size_t ti = temp_index + j;
-                if (ti >= clekser->buffer_size){
-                    clekser->index = ti;
-                    return 0;
-                }
-                if (clekser->buffer[ti] != end_del[j]){
-                    matches = false;
-                    break;
-                }
-            }
-            if (matches){
-                clekser->index = temp_index+del_size-1;
-                return 0;
-            }
-            temp_index += 1;
+        if (compiled->whitespace_count > CLEKS_MAX_SIMD_SET) compiled->whitespace_count = 0;
+    }
+    for (size_t i=config.custom_token_count; i-- > 0;){
+        char symbol = config.custom_tokens[i].symbol;
+        const char *long_symbol = config.custom_tokens[i].long_symbol;
+        // a one character long_symbol is a regular symbol
+        if (symbol == '\0' && long_symbol != NULL && long_symbol[0] != '\0' && long_symbol[1] == '\0') symbol = long_symbol[0];
+        if (symbol == '\0') continue;
+        compiled->classes[(uint8_t) symbol] |= CLEKS_CLASS_SYMBOL;
+        compiled->symbols[(uint8_t) symbol] = (CleksTokenType) i;
+        if (config.custom_tokens[i].coalesce) compiled->classes[(uint8_t) symbol] |= CLEKS_CLASS_COALESCE;
+        else compiled->classes[(uint8_t) symbol] &= ~CLEKS_CLASS_COALESCE;
+    }
+    for (size_t i=config.string_count; i-- > 0;){
+        uint8_t start_del = (uint8_t) config.strings[i].start_del;
+        compiled->classes[start_del] |= CLEKS_CLASS_STRING;
+        compiled->string_ends[start_del] = config.strings[i].end_del;
+    }
+    if (config.comment_count > 0){
+        compiled->comments = (CleksCompiledComment*) calloc(config.comment_count, sizeof(CleksCompiledComment));
+        size_t trie_capacity = 1;
+        for (size_t i=0; i<config.comment_count; ++i) trie_capacity += strlen(config.comments[i].start_del);
+        if (compiled->comments == NULL || !cleks_init_trie(&compiled->comment_trie, trie_capacity)){
+            Cleks_free_compiled_config(compiled);
+            cleks_error("Failed to allocate compiled comments!");
+            return NULL;
         }
-        return 1;
+        for (size_t i=0; i<config.comment_count; ++i){
+            CleksCompiledComment *comment = &compiled->comments[i];
+            comment->start_del = config.comments[i].start_del;
+            comment->end_del = config.comments[i].end_del;
+            comment->start_len = strlen(comment->start_del);
+            comment->end_len = strlen(comment->end_del);
+            if (comment->start_len == 0) continue;
+            compiled->classes[(uint8_t) comment->start_del[0]] |= CLEKS_CLASS_COMMENT;
+            // the first matching comment takes precedence, so comments starting with an earlier one never match
+            cleks_trie_insert(&compiled->comment_trie, comment->start_del, comment->start_len, (int) i, true);
+        }
+        compiled->comment_count = config.comment_count;
     }
-    return 1;
-}
-
-CleksTokens* Cleks_lex(char *buffer, size_t buffer_size, CleksConfig config)
-{
-    cleks_assert(buffer != NULL && buffer_size != 0, "Invalid arguments!"); 
-    Clekser clekser = {.buffer=buffer, .buffer_size=buffer_size, .index=0};
-    CleksTokens *tokens = Cleks_create_tokens(16, config);
-    char c;
-    while (clekser.index <= buffer_size && (c = buffer[clekser.index]) != '\0'){
-        int int_token;
-        // try to lex string
-        bool string_found = false;
-        for (size_t i=0; i<config.string_count; ++i){
-            if (c == config.strings[i].start_del){
-                clekser.index += 1;
-                if (Cleks_lex_string(&clekser, tokens, config, config.strings[i].end_del) == 1){
-                    Cleks_free_tokens(tokens);
-                    return NULL;
-                }
-                string_found = true;
-                clekser.index += 1;
-            }
+    size_t trie_capacity = 1;
+    for (size_t i=0; i<config.custom_token_count; ++i){
+        if (config.custom_tokens[i].long_symbol != NULL) trie_capacity += strlen(config.custom_tokens[i].long_symbol);
+    }
+    if (trie_capacity > 1){
+        if (!cleks_init_trie(&compiled->symbol_trie, trie_capacity)){
+            Cleks_free_compiled_config(compiled);
+            cleks_error("Failed to allocate symbol trie!");
+            return NULL;
         }
-        if (string_found) continue;
-        // try to lex custom symbol
-        if ((int_token = Cleks_char_to_token(c, config.custom_tokens, config.custom_token_count)) != CLEKS_NOT_FOUND){
-            Cleks_append_token(tokens, (CleksTokenType) int_token, NULL);
+        for (size_t i=0; i<config.custom_token_count; ++i){
+            const char *long_symbol = config.custom_tokens[i].long_symbol;
+            if (long_symbol == NULL || long_symbol[0] == '\0' || long_symbol[1] == '\0') continue;
+            compiled->classes[(uint8_t) long_symbol[0]] |= CLEKS_CLASS_LONG_SYMBOL;
+            // longer symbols take precedence, so every symbol is kept
+            cleks_trie_insert(&compiled->symbol_trie, long_symbol, strlen(long_symbol), (int) i, false);
         }
-        // try to lex whitespace
-        else if (Cleks_char_in_string(c, config.whitespaces) == 0){}
-        // try to lex comment
-        else if (Cleks_lex_comment(&clekser, config) == 0){}
-        // try to lex word
-        else{
-            if (Cleks_lex_word(&clekser, tokens, config) == 0){
-                continue;
-            }
-            else{
-                Cleks_free_tokens(tokens);
-                return NULL;
+    }
+    // keep the load factor of the keyword table at or below 50%
+    size_t word_count = 0;
+    for (size_t i=0; i<config.custom_token_count; ++i){
+        if (config.custom_tokens[i].word != NULL && config.custom_tokens[i].word[0] != '\0') word_count += 1;
+    }
+    if (word_count > 0){
+        size_t capacity = 8;
+        while (capacity < word_count*2) capacity *= 2;
+        compiled->keywords = (CleksKeyword*) calloc(capacity, sizeof(CleksKeyword));
+        if (compiled->keywords == NULL){
+            Cleks_free_compiled_config(compiled);
+            cleks_error("Failed to allocate keyword table!");
+            return NULL;
+        }
+        compiled->keyword_capacity = capacity;
+        for (size_t i=0; i<config.custom_token_count; ++i){
+            const char *word = config.custom_tokens[i].word;
+            if (word == NULL || word[0] == '\0') continue;
+            size_t length = strlen(word);
+            size_t slot = cleks_hash(word, length) & (capacity-1);
+            // earlier definitions take precedence over duplicates
+            while (compiled->keywords[slot].word != NULL && (compiled->keywords[slot].length != length || memcmp(compiled->keywords[slot].word, word, length) != 0)){
+                slot = (slot+1) & (capacity-1);
             }
+            if (compiled->keywords[slot].word != NULL) continue;
+            compiled->keywords[slot] = (CleksKeyword){.word=word, .length=length, .type=(CleksTokenType) i};
         }
-        clekser.index += 1;
     }
-    return tokens;
+    return compiled;
 }
 
-char* Cleks_token_to_string(CleksToken *token, CleksConfig config)
+int Cleks_find_keyword(CleksCompiledConfig *compiled, const char *word, size_t length)
 {
-    if (token == NULL || !CLEKS_TOKEN_IS_VALID(token)) return NULL;
-    if (CLEKS_TOKEN_IS_CUSTOM(token) && token->type < config.custom_token_count){
-        return config.custom_tokens[token->type].print_string;
+    if (compiled->keyword_capacity == 0) return CLEKS_NOT_FOUND;
+    size_t slot = cleks_hash(word, length) & (compiled->keyword_capacity-1);
+    CleksKeyword *keyword;
+    while ((keyword = &compiled->keywords[slot])->word != NULL){
+        if (keyword->length == length && memcmp(keyword->word, word, length) == 0) return keyword->type;
+        slot = (slot+1) & (compiled->keyword_capacity-1);
     }
-    return config.default_tokens[token->type+config.default_token_count].print_string;
+    return CLEKS_NOT_FOUND;
 }
 
-void cleks_print_token(CleksToken *token, CleksConfig config)
+void Cleks_free_compiled_config(CleksCompiledConfig *compiled)
 {
-    if (!CLEKS_TOKEN_IS_VALID(token) || token->type >= (int) config.custom_token_count){
-        cleks_error("Invalid token: token: %p, type: %d", token, (int) token->type);
-        return;
-    }
-    printf("Token % 3d: %s", token->type, Cleks_token_to_string(token, config));
-    if (token->value != NULL){
-        printf(" \"%s\"", token->value);
+    if (compiled != NULL){
+        free(compiled->comments);
+        free(compiled->keywords);
+        free(compiled->symbol_trie.nodes);
+        free(compiled->comment_trie.nodes);
+        free(compiled);
     }
-    putchar('\n');
 }
 
-void Cleks_print_tokens(CleksTokens *tokens)
+/* Errors */
+
+const char* Cleks_error_to_string(CleksErrorCode code)
 {
-    if (tokens == NULL){
-        cleks_error("Invalid tokens given!");
-        return;
-    }
-    printf("Token count: %u\n  ", tokens->size);
-    for (size_t i=0; i<tokens->size; ++i){
-        cleks_print_token(tokens->items[i], tokens->config);
-        printf("  ");
+    switch (code){
+        case CLEKS_OK: return "No error";
+        case CLEKS_ERROR_ALLOCATION: return "Allocation failed";
+        case CLEKS_ERROR_UNCLOSED_STRING: return "Unclosed string delimeters";
+        case CLEKS_ERROR_UNEXPECTED_TOKEN: return "Unexpected token";
+        case CLEKS_ERROR_UNEXPECTED_END: return "Unexpected end of input";
+        case CLEKS_ERROR_INVALID_UTF8: return "Invalid UTF-8 sequence";
+        case CLEKS_ERROR_INVALID_ESCAPE: return "Invalid escape sequence";
+        case CLEKS_ERROR_INVALID_EDIT: return "Invalid edit";
+        default: return "Unknown error";
     }
-    putchar('\n');
+}
+
+static CleksStep cleks_fail(Clekser *clekser, CleksErrorCode code, size_t offset)
+{
+    clekser->error = code;
+    clekser->error_offset = offset;
+    return CLEKS_STEP_ERROR;
+}
+
+static void cleks_count_lines(const char *buffer, size_t size, size_t base, size_t *line, size_t *line_start)
+{
+    const char *p = buffer, *end = buffer + size;
+    while (p < end && (p = (const char*) memchr(p, '\n', end - p)) != NULL){
+        p += 1;
+        *line += 1;
+        *line_start = base + (p - buffer);
+    }
+}
+
+static void cleks_report_error(CleksError *error, Clekser *clekser, size_t base, size_t line, size_t line_start)
+{
+    error->count += 1;
+    // only the first error is described, the lines are only counted for it
+    if (error->code != CLEKS_OK) return;
+    cleks_count_lines(clekser->buffer, clekser->error_offset, base, &line, &line_start);
+    error->code = clekser->error;
+    error->offset = base + clekser->error_offset;
+    error->line = line;
+    error->column = error->offset - line_start + 1;
+}
+
+// reports the error of clekser and records it in tokens, stopped tells whether lexing ends at it
+static void cleks_note_error(CleksTokens *tokens, CleksError *error, Clekser *clekser, bool stopped)
+{
+    cleks_report_error(error, clekser, 0, 1, 0);
+    if (tokens->error_count == 0){
+        tokens->clean_size = clekser->error_offset;
+        tokens->error_code = clekser->error;
+    }
+    tokens->error_count += 1;
+    tokens->error_end = stopped ? SIZE_MAX : clekser->error_offset + 1;
+}
+
+static void cleks_clear_errors(CleksTokens *tokens)
+{
+    tokens->clean_size = tokens->buffer_size;
+    tokens->error_code = CLEKS_OK;
+    tokens->error_count = 0;
+    tokens->error_end = 0;
+}
+
+/* Source locations */
+
+bool Cleks_line_index(CleksLineIndex *index, const char *buffer, size_t buffer_size, CleksAllocator *allocator)
+{
+    cleks_assert(index != NULL && (buffer != NULL || buffer_size == 0), "Invalid arguments!");
+    memset(index, 0, sizeof(*index));
+    if (allocator != NULL) index->allocator = *allocator;
+    // the newlines are counted first, so that the index is allocated once
+    size_t newlines = cleks_find_all(buffer, buffer + buffer_size, '\n', 0, NULL);
+    index->line_starts = (size_t*) Cleks_alloc(&index->allocator, (newlines+1)*sizeof(size_t));
+    if (index->line_starts == NULL) return false;
+    index->line_starts[0] = 0;
+    // every further line starts after a newline
+    cleks_find_all(buffer, buffer + buffer_size, '\n', 1, index->line_starts + 1);
+    index->line_count = newlines + 1;
+    return true;
+}
+
+void Cleks_line_location(CleksLineIndex *index, size_t offset, size_t *line, size_t *column)
+{
+    cleks_assert(index != NULL && index->line_count > 0, "Invalid line index: %p", index);
+    // the last line starting at or before offset
+    size_t low = 0, high = index->line_count;
+    while (high - low > 1){
+        size_t mid = low + (high - low)/2;
+        if (index->line_starts[mid] <= offset) low = mid;
+        else high = mid;
+    }
+    if (line != NULL) *line = low + 1;
+    if (column != NULL) *column = offset - index->line_starts[low] + 1;
+}
+
+void Cleks_free_line_index(CleksLineIndex *index)
+{
+    if (index == NULL) return;
+    Cleks_free(&index->allocator, index->line_starts);
+    index->line_starts = NULL;
+    index->line_count = 0;
+}
+
+bool Cleks_token_location(CleksTokens *tokens, CleksToken *token, size_t *line, size_t *column)
+{
+    cleks_assert(tokens != NULL && token != NULL, "Invalid arguments: tokens=%p, token=%p", tokens, token);
+    // the lines are only indexed once a location is requested
+    if (tokens->lines.line_count == 0 && !Cleks_line_index(&tokens->lines, tokens->buffer, tokens->buffer_size, &tokens->allocator)) return false;
+    Cleks_line_location(&tokens->lines, cleks_token_start(token), line, column);
+    return true;
+}
+
+// returns the length of the longest key of the trie starting at index, 0 if there is none
+static size_t cleks_trie_match(CleksTrie *trie, Clekser *clekser, size_t index, int *value, bool *more)
+{
+    uint32_t node = trie->roots[(uint8_t) clekser->buffer[index]];
+    size_t length = 0;
+    *more = false;
+    if (node == 0) return 0;
+    if (trie->nodes[node].value != CLEKS_NOT_FOUND){
+        length = 1;
+        *value = trie->nodes[node].value;
+    }
+    for (size_t i=index+1; trie->nodes[node].child != 0; ++i){
+        if (i >= clekser->buffer_size){
+            // a longer key may be completed in the next chunk
+            *more = !clekser->eof;
+            break;
+        }
+        uint32_t child = trie->nodes[node].child;
+        while (child != 0 && trie->nodes[child].byte != (uint8_t) clekser->buffer[i]) child = trie->nodes[child].sibling;
+        if (child == 0) break;
+        node = child;
+        if (trie->nodes[node].value != CLEKS_NOT_FOUND){
+            length = i - index + 1;
+            *value = trie->nodes[node].value;
+        }
+    }
+    return length;
+}
+
+// gives the token the shared copy of its value
+static CleksStep cleks_intern_token(Clekser *clekser, CleksToken *token, const char *text, size_t length, size_t offset)
+{
+    int id = Cleks_intern(clekser->interns, text, length);
+    if (id == CLEKS_NOT_FOUND) return cleks_fail(clekser, CLEKS_ERROR_ALLOCATION, offset);
+    token->value = (char*) clekser->interns->items[id].text;
+    token->symbol_id = id;
+    token->flags |= CLEKS_TOKEN_FLAG_INTERNED;
+    return CLEKS_STEP_TOKEN;
+}
+
+// returns the position where the scan of the token at index continues, which was saved by cleks_suspend, and clears it
+static size_t cleks_resume(Clekser *clekser, size_t start, uint8_t *flags)
+{
+    size_t resume = clekser->resume;
+    if (resume == 0) return start;
+    clekser->resume = 0;
+    // the saved position is ignored if the buffer no longer reaches it
+    if (resume > clekser->buffer_size - clekser->index) return start;
+    if (flags != NULL) *flags |= clekser->resume_flags;
+    return clekser->index + resume;
+}
+
+// saves the position where the scan of the token at index continues once more input is available
+static CleksStep cleks_suspend(Clekser *clekser, size_t position, uint8_t flags)
+{
+    clekser->resume = position - clekser->index;
+    clekser->resume_flags = flags;
+    return CLEKS_STEP_MORE;
+}
+
+CleksStep Cleks_lex_word(Clekser *clekser, CleksCompiledConfig *compiled, CleksToken *token)
+{
+    cleks_assert(clekser != NULL && token != NULL, "Invalid Arguments: clekser=%p, token=%p", clekser, token);
+    CleksConfig config = compiled->config;
+    size_t word_start = clekser->index;
+    clekser->index = cleks_resume(clekser, word_start, NULL);
+    while (clekser->index < clekser->buffer_size){
+        uint8_t class = compiled->classes[(uint8_t) clekser->buffer[clekser->index]];
+        if (class & CLEKS_CLASS_WORD_END) break;
+        if (class & CLEKS_CLASS_LONG_SYMBOL){
+            // only a complete multi-character symbol ends the word
+            int type;
+            bool more;
+            size_t length = cleks_trie_match(&compiled->symbol_trie, clekser, clekser->index, &type, &more);
+            if (more){
+                size_t symbol_start = clekser->index;
+                clekser->index = word_start;
+                return cleks_suspend(clekser, symbol_start, 0);
+            }
+            if (length > 0) break;
+        }
+        clekser->index += 1;
+    }
+    if (clekser->index >= clekser->buffer_size && !clekser->eof){
+        // the word may continue in the next chunk, where the scan continues
+        size_t word_end = clekser->index;
+        clekser->index = word_start;
+        return cleks_suspend(clekser, word_end, 0);
+    }
+    char *word_start_ptr = clekser->buffer + word_start;
+    size_t word_len = clekser->index - word_start;
+    int keyword = Cleks_find_keyword(compiled, word_start_ptr, word_len);
+    *token = (CleksToken){.type=(CleksTokenType) keyword, .offset=word_start, .length=word_len};
+    if (keyword != CLEKS_NOT_FOUND) return CLEKS_STEP_TOKEN;
+    CLEKS_TIMER_START(number_timer);
+    token->type = cleks_parse_number(word_start_ptr, word_len, config.flags, token);
+    CLEKS_TIMER_STOP(clekser->stats, CLEKS_PHASE_NUMBER, number_timer);
+    if (token->type == CLEKS_WORD && (config.flags & CLEKS_FLAG_IGNORE_UNKNOWN)) return CLEKS_STEP_SKIP;
+    if (token->type == CLEKS_WORD && clekser->interns != NULL) return cleks_intern_token(clekser, token, word_start_ptr, word_len, word_start);
+    if ((config.flags & CLEKS_FLAG_SPANS) == 0){
+        token->value = cleks_strndup(clekser->allocator, word_start_ptr, word_len);
+        if (token->value == NULL) return cleks_fail(clekser, CLEKS_ERROR_ALLOCATION, word_start);
+        CLEKS_STAT(clekser->stats, allocations, 1);
+        CLEKS_STAT(clekser->stats, allocated_bytes, word_len+1);
+    }
+    return CLEKS_STEP_TOKEN;
+}
+
+// returns the length of the UTF-8 sequence starting with the non-ASCII byte at p, -1 if it is invalid
+// the length may exceed end when the available bytes are the start of a valid sequence
+static int cleks_utf8_length(const unsigned char *p, const unsigned char *end)
+{
+    // the range of the second byte excludes overlong forms, surrogates and code points above U+10FFFF
+    unsigned char low = 0x80, high = 0xBF;
+    int length;
+    if (*p >= 0xC2 && *p <= 0xDF) length = 2;
+    else if (*p >= 0xE0 && *p <= 0xEF){
+        length = 3;
+        if (*p == 0xE0) low = 0xA0;
+        if (*p == 0xED) high = 0x9F;
+    }
+    else if (*p >= 0xF0 && *p <= 0xF4){
+        length = 4;
+        if (*p == 0xF0) low = 0x90;
+        if (*p == 0xF4) high = 0x8F;
+    }
+    else return -1;
+    for (int i=1; i<length && p+i < end; ++i){
+        if (p[i] < low || p[i] > high) return -1;
+        low = 0x80;
+        high = 0xBF;
+    }
+    return length;
+}
+
+// parses the 4 hex digits of a \uXXXX escape, returns 1 on success, 0 if end comes first and -1 if one is not a hex digit
+static int cleks_hex4(const char *p, const char *end, unsigned *code)
+{
+    *code = 0;
+    for (int i=0; i<4; ++i){
+        if (p+i >= end) return 0;
+        char c = p[i];
+        unsigned digit;
+        if (c >= '0' && c <= '9') digit = c - '0';
+        else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+        else return -1;
+        *code = *code << 4 | digit;
+    }
+    return 1;
+}
+
+// returns the length of the JSON escape sequence at p, 0 if end comes first and -1 if it is invalid
+static int cleks_json_escape_length(const char *p, const char *end, uint8_t *flags)
+{
+    if (p+1 >= end) return 0;
+    switch (p[1]){
+        case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't': return 2;
+        case 'u': break;
+        default: return -1;
+    }
+    unsigned code, low;
+    int parsed = cleks_hex4(p + 2, end, &code);
+    if (parsed <= 0) return parsed;
+    *flags |= CLEKS_TOKEN_FLAG_UNICODE;
+    if (code < 0xD800 || code > 0xDFFF) return 6;
+    // a high surrogate has to be followed by the escape of a low surrogate
+    if (code > 0xDBFF) return -1;
+    if (p+6 >= end || (p[6] == '\\' && p+7 >= end)) return 0;
+    if (p[6] != '\\' || p[7] != 'u') return -1;
+    parsed = cleks_hex4(p + 8, end, &low);
+    if (parsed <= 0) return parsed;
+    return low >= 0xDC00 && low <= 0xDFFF ? 12 : -1;
+}
+
+// finds the end delimiter of the string whose content starts at index, validating it according to the config flags
+static CleksStep cleks_scan_string(Clekser *clekser, size_t index, char end_del, uint8_t config_flags, size_t *str_end, uint8_t *flags)
+{
+    size_t str_start = index;
+    const char *buffer = clekser->buffer;
+    const char *buffer_end = buffer + clekser->buffer_size;
+    bool utf8 = config_flags & CLEKS_FLAG_VALIDATE_UTF8;
+    bool json = config_flags & CLEKS_FLAG_JSON_ESCAPES;
+    index = cleks_resume(clekser, index, flags);
+    while (true){
+        if (index < clekser->buffer_size){
+            // besides the end delimiter and escapes, only non-ASCII bytes stop the vectorized scan
+            const char *p = utf8 ? cleks_find2_ascii(buffer + index, buffer_end, end_del, '\\') : cleks_find2(buffer + index, buffer_end, end_del, '\\');
+            index = p - buffer;
+        }
+        if (index >= clekser->buffer_size && !clekser->eof){
+            // the string may be closed in the next chunk, where the scan continues
+            return cleks_suspend(clekser, index, *flags);
+        }
+        if (index >= clekser->buffer_size) return cleks_fail(clekser, CLEKS_ERROR_UNCLOSED_STRING, str_start - 1);
+        if (buffer[index] == end_del) break;
+        int length;
+        if (buffer[index] == '\\'){
+            // the escaped character never closes the string
+            *flags |= CLEKS_TOKEN_FLAG_ESCAPES;
+            CLEKS_STAT(clekser->stats, escapes, 1);
+            if (json) length = cleks_json_escape_length(buffer + index, buffer_end, flags);
+            else if (utf8 && index+1 < clekser->buffer_size && (unsigned char) buffer[index+1] >= 0x80){
+                // an escaped non-ASCII character is skipped and validated as a whole
+                length = cleks_utf8_length((const unsigned char*) buffer + index + 1, (const unsigned char*) buffer_end);
+                if (length < 0) return cleks_fail(clekser, CLEKS_ERROR_INVALID_UTF8, index + 1);
+                length += 1;
+            }
+            else length = 2;
+            if (length < 0) return cleks_fail(clekser, CLEKS_ERROR_INVALID_ESCAPE, index);
+        }
+        else{
+            length = cleks_utf8_length((const unsigned char*) buffer + index, (const unsigned char*) buffer_end);
+            if (length < 0) return cleks_fail(clekser, CLEKS_ERROR_INVALID_UTF8, index);
+        }
+        if (length == 0 || index + length > clekser->buffer_size){
+            // a sequence cut off by the end of the buffer is scanned again from its start with the next chunk
+            if (!clekser->eof) return cleks_suspend(clekser, index, *flags);
+            return cleks_fail(clekser, CLEKS_ERROR_UNCLOSED_STRING, str_start - 1);
+        }
+        index += length;
+    }
+    *str_end = index;
+    return CLEKS_STEP_TOKEN;
+}
+
+CleksStep Cleks_lex_string(Clekser *clekser, CleksCompiledConfig *compiled, CleksToken *token)
+{
+    cleks_assert(clekser != NULL && token != NULL, "Invalid Arguments: clekser=%p, token=%p", clekser, token);
+    char str_end_del = compiled->string_ends[(uint8_t) clekser->buffer[clekser->index]];
+    size_t str_start = clekser->index + 1;
+    uint8_t flags = CLEKS_TOKEN_FLAG_NONE;
+    size_t index;
+    CleksStep step = cleks_scan_string(clekser, str_start, str_end_del, compiled->config.flags, &index, &flags);
+    if (step != CLEKS_STEP_TOKEN) return step;
+    clekser->index = index + 1;
+    CLEKS_STAT(clekser->stats, string_bytes, clekser->index - (str_start - 1));
+
+    size_t str_len = index - str_start;
+    *token = (CleksToken){.type=CLEKS_STRING, .offset=str_start, .length=str_len, .flags=flags};
+    if (clekser->interns != NULL){
+        if ((flags & CLEKS_TOKEN_FLAG_ESCAPES) == 0) return cleks_intern_token(clekser, token, clekser->buffer + str_start, str_len, str_start - 1);
+        // strings with escape sequences are interned by their unescaped text
+        char small[256];
+        char *unescaped = str_len < sizeof(small) ? small : (char*) Cleks_alloc(clekser->allocator, str_len+1);
+        if (unescaped == NULL) return cleks_fail(clekser, CLEKS_ERROR_ALLOCATION, str_start - 1);
+        size_t length = cleks_unescape(clekser->buffer + str_start, str_len, unescaped, str_len+1, flags & CLEKS_TOKEN_FLAG_UNICODE);
+        CleksStep step = cleks_intern_token(clekser, token, unescaped, length, str_start - 1);
+        if (unescaped != small) Cleks_free(clekser->allocator, unescaped);
+        return step;
+    }
+    if ((compiled->config.flags & CLEKS_FLAG_SPANS) == 0){
+        char *str_value = (char*) Cleks_alloc(clekser->allocator, str_len+1);
+        if (str_value == NULL) return cleks_fail(clekser, CLEKS_ERROR_ALLOCATION, str_start - 1);
+        CLEKS_STAT(clekser->stats, allocations, 1);
+        CLEKS_STAT(clekser->stats, allocated_bytes, str_len+1);
+        if (flags & CLEKS_TOKEN_FLAG_ESCAPES){
+            cleks_unescape(clekser->buffer + str_start, str_len, str_value, str_len+1, flags & CLEKS_TOKEN_FLAG_UNICODE);
+        }
+        else{
+            memcpy(str_value, clekser->buffer + str_start, str_len);
+            str_value[str_len] = '\0';
+        }
+        token->value = str_value;
+    }
+    return CLEKS_STEP_TOKEN;
+}
+
+static CleksStep cleks_skip_comment(Clekser *clekser, CleksCompiledConfig *compiled, int comment_index, size_t temp_index)
+{
+    CleksCompiledComment comment = compiled->comments[comment_index];
+    if (comment.end_len == 0){
+        clekser->index = temp_index;
+        clekser->comment = CLEKS_NOT_FOUND;
+        return CLEKS_STEP_SKIP;
+    }
+    // skip until end_del
+    const char *buffer_end = clekser->buffer + clekser->buffer_size;
+    const char *found = cleks_find_str(clekser->buffer + temp_index, buffer_end, comment.end_del, comment.end_len);
+    if (found != buffer_end){
+        clekser->index = (found - clekser->buffer) + comment.end_len;
+        clekser->comment = CLEKS_NOT_FOUND;
+        return CLEKS_STEP_SKIP;
+    }
+    if (!clekser->eof){
+        // keep only what could be the beginning of end_del
+        if (clekser->buffer_size - temp_index >= comment.end_len) temp_index = clekser->buffer_size - comment.end_len + 1;
+        clekser->index = temp_index;
+        clekser->comment = comment_index;
+        return CLEKS_STEP_MORE;
+    }
+    // unclosed comments reach until the end of the buffer
+    clekser->index = clekser->buffer_size;
+    clekser->comment = CLEKS_NOT_FOUND;
+    return CLEKS_STEP_SKIP;
+}
+
+CleksStep Cleks_lex_comment(Clekser *clekser, CleksCompiledConfig *compiled)
+{
+    cleks_assert(clekser != NULL, "Invalid arguments: clekser: %p!", clekser);
+    if (compiled->comment_count == 0 || clekser->index >= clekser->buffer_size) return CLEKS_STEP_NONE;
+    int comment;
+    bool more;
+    size_t length = cleks_trie_match(&compiled->comment_trie, clekser, clekser->index, &comment, &more);
+    if (more) return CLEKS_STEP_MORE;
+    if (length == 0) return CLEKS_STEP_NONE;
+    return cleks_skip_comment(clekser, compiled, comment, clekser->index + length);
+}
+
+#ifdef CLEKS_STATS
+static CleksStep cleks_count_comment(Clekser *clekser, size_t start, CleksStep step)
+{
+    if (step == CLEKS_STEP_SKIP || step == CLEKS_STEP_MORE) clekser->stats.comment_bytes += clekser->index - start;
+    return step;
+}
+#define CLEKS_COUNT_COMMENT(clekser, start, step) cleks_count_comment(clekser, start, step)
+#else
+#define CLEKS_COUNT_COMMENT(clekser, start, step) ((void) (start), (step))
+#endif // CLEKS_STATS
+
+static inline CleksStep cleks_lex_step(Clekser *clekser, CleksCompiledConfig *compiled, CleksToken *token)
+{
+    if (clekser->comment != CLEKS_NOT_FOUND){
+        size_t comment_start = clekser->index;
+        CLEKS_TIMER_START(comment_timer);
+        CleksStep step = cleks_skip_comment(clekser, compiled, clekser->comment, clekser->index);
+        CLEKS_TIMER_STOP(clekser->stats, CLEKS_PHASE_COMMENT, comment_timer);
+        return CLEKS_COUNT_COMMENT(clekser, comment_start, step);
+    }
+    if (clekser->index >= clekser->buffer_size){
+        return clekser->eof ? CLEKS_STEP_END : CLEKS_STEP_MORE;
+    }
+    char c = clekser->buffer[clekser->index];
+    uint8_t class = compiled->classes[(uint8_t) c];
+    // try to lex string
+    if (class & CLEKS_CLASS_STRING){
+        CLEKS_TIMER_START(string_timer);
+        CleksStep step = Cleks_lex_string(clekser, compiled, token);
+        CLEKS_TIMER_STOP(clekser->stats, CLEKS_PHASE_STRING, string_timer);
+        return step;
+    }
+    // try to lex multi-character symbol, longer symbols take precedence over single characters
+    if (class & CLEKS_CLASS_LONG_SYMBOL){
+        int type;
+        bool more;
+        size_t length = cleks_trie_match(&compiled->symbol_trie, clekser, clekser->index, &type, &more);
+        if (more) return CLEKS_STEP_MORE;
+        if (length > 0){
+            *token = (CleksToken){.type=(CleksTokenType) type, .offset=clekser->index, .length=length};
+            clekser->index += length;
+            return CLEKS_STEP_TOKEN;
+        }
+    }
+    // try to lex custom symbol
+    if (class & CLEKS_CLASS_SYMBOL){
+        size_t length = 1;
+        if (class & CLEKS_CLASS_COALESCE){
+            length = cleks_resume(clekser, clekser->index + 1, NULL) - clekser->index;
+            while (clekser->index + length < clekser->buffer_size && clekser->buffer[clekser->index + length] == c) length += 1;
+            // the run may continue in the next chunk
+            if (clekser->index + length >= clekser->buffer_size && !clekser->eof) return cleks_suspend(clekser, clekser->index + length, 0);
+        }
+        *token = (CleksToken){.type=compiled->symbols[(uint8_t) c], .offset=clekser->index, .length=length};
+        clekser->index += length;
+        return CLEKS_STEP_TOKEN;
+    }
+    // try to lex whitespace
+    if (class & CLEKS_CLASS_WHITESPACE){
+        size_t whitespace_start = clekser->index;
+        clekser->index += 1;
+        if (compiled->whitespace_count > 0){
+            clekser->index = cleks_skip_set(clekser->buffer + clekser->index, clekser->buffer + clekser->buffer_size, compiled->whitespaces, compiled->whitespace_count) - clekser->buffer;
+        }
+        else{
+            while (clekser->index < clekser->buffer_size && (compiled->classes[(uint8_t) clekser->buffer[clekser->index]] & CLEKS_CLASS_WHITESPACE)){
+                clekser->index += 1;
+            }
+        }
+        CLEKS_STAT(clekser->stats, whitespace_bytes, clekser->index - whitespace_start);
+        return CLEKS_STEP_SKIP;
+    }
+    // try to lex comment
+    if (class & CLEKS_CLASS_COMMENT){
+        size_t comment_start = clekser->index;
+        CLEKS_TIMER_START(comment_timer);
+        CleksStep step = Cleks_lex_comment(clekser, compiled);
+        CLEKS_TIMER_STOP(clekser->stats, CLEKS_PHASE_COMMENT, comment_timer);
+        if (step != CLEKS_STEP_NONE) return CLEKS_COUNT_COMMENT(clekser, comment_start, step);
+    }
+    // try to lex word
+    CLEKS_TIMER_START(word_timer);
+    CleksStep step = Cleks_lex_word(clekser, compiled, token);
+    CLEKS_TIMER_STOP(clekser->stats, CLEKS_PHASE_WORD, word_timer);
+    return step;
+}
+
+#ifdef CLEKS_STATS
+static void cleks_count_token(CleksStats *stats, CleksTokenType type)
+{
+    stats->tokens += 1;
+    if (type < CLEKS_STATS_MAX_TOKENS) stats->token_counts[type + CLEKS_TOKEN_COUNT] += 1;
+    else stats->other_tokens += 1;
+}
+#endif // CLEKS_STATS
+
+CleksStep Cleks_lex_step(Clekser *clekser, CleksCompiledConfig *compiled, CleksToken *token)
+{
+    CleksStep step = cleks_lex_step(clekser, compiled, token);
+#ifdef CLEKS_STATS
+    if (step == CLEKS_STEP_TOKEN) cleks_count_token(&clekser->stats, token->type);
+#endif // CLEKS_STATS
+    return step;
+}
+
+#ifdef CLEKS_STATS
+static void cleks_merge_stats(CleksStats *into, CleksStats *from)
+{
+    into->bytes += from->bytes;
+    into->tokens += from->tokens;
+    for (size_t i=0; i<CLEKS_ARR_LEN(into->token_counts); ++i) into->token_counts[i] += from->token_counts[i];
+    into->other_tokens += from->other_tokens;
+    into->string_bytes += from->string_bytes;
+    into->comment_bytes += from->comment_bytes;
+    into->whitespace_bytes += from->whitespace_bytes;
+    into->escapes += from->escapes;
+    into->allocations += from->allocations;
+    into->allocated_bytes += from->allocated_bytes;
+    into->regrowths += from->regrowths;
+    for (size_t i=0; i<CLEKS_PHASE_COUNT; ++i) into->cycles[i] += from->cycles[i];
+}
+#endif // CLEKS_STATS
+
+// returns false if lexing stopped at an error
+static bool cleks_lex_into(CleksTokens *tokens, char *buffer, size_t buffer_size, CleksCompiledConfig *compiled, CleksErrorPolicy policy, CleksError *error, CleksInternTable *interns)
+{
+    Clekser clekser = {.buffer=buffer, .buffer_size=buffer_size, .index=0, .eof=true, .comment=CLEKS_NOT_FOUND, .allocator=&tokens->value_allocator, .interns=interns};
+    tokens->buffer = buffer;
+    tokens->buffer_size = buffer_size;
+    cleks_clear_errors(tokens);
+    CLEKS_STAT(clekser.stats, bytes, buffer_size);
+    bool completed = true;
+    CleksToken token;
+    CleksStep step;
+    while ((step = Cleks_lex_step(&clekser, compiled, &token)) != CLEKS_STEP_END){
+        if (step == CLEKS_STEP_TOKEN){
+            if (!cleks_push_token(tokens, &token)){
+                cleks_fail(&clekser, CLEKS_ERROR_ALLOCATION, cleks_token_start(&token));
+                cleks_note_error(tokens, error, &clekser, true);
+                completed = false;
+                break;
+            }
+        }
+        else if (step == CLEKS_STEP_ERROR){
+            bool stopped = policy != CLEKS_ON_ERROR_RECOVER || clekser.error == CLEKS_ERROR_ALLOCATION;
+            cleks_note_error(tokens, error, &clekser, stopped);
+            if (stopped){
+                completed = false;
+                break;
+            }
+            // resynchronize at the start of the next line
+            const char *newline = (const char*) memchr(buffer + clekser.error_offset, '\n', buffer_size - clekser.error_offset);
+            clekser.index = newline != NULL ? (size_t) (newline - buffer) + 1 : buffer_size;
+        }
+    }
+#ifdef CLEKS_STATS
+    cleks_merge_stats(&tokens->stats, &clekser.stats);
+#endif // CLEKS_STATS
+    return completed;
+}
+
+CleksTokens* Cleks_lex_checked(char *buffer, size_t buffer_size, CleksCompiledConfig *compiled, CleksErrorPolicy policy, CleksError *error)
+{
+    cleks_assert((buffer != NULL || buffer_size == 0) && compiled != NULL, "Invalid arguments!");
+    CleksError local_error;
+    if (error == NULL) error = &local_error;
+    memset(error, 0, sizeof(*error));
+    CleksTokens *tokens = Cleks_create_tokens(16, compiled->config);
+    if (tokens == NULL){
+        *error = (CleksError){.code=CLEKS_ERROR_ALLOCATION, .offset=0, .line=1, .column=1, .count=1};
+        return NULL;
+    }
+    if (!cleks_lex_into(tokens, buffer, buffer_size, compiled, policy, error, NULL) && policy == CLEKS_ON_ERROR_FREE){
+        Cleks_free_tokens(tokens);
+        return NULL;
+    }
+    return tokens;
+}
+
+CleksTokens* Cleks_lex_compiled(char *buffer, size_t buffer_size, CleksCompiledConfig *compiled)
+{
+    CleksError error;
+    CleksTokens *tokens = Cleks_lex_checked(buffer, buffer_size, compiled, CLEKS_ON_ERROR_FREE, &error);
+    if (tokens == NULL){
+        cleks_error("[PARSING] %s at %zu:%zu (index %zu)!", Cleks_error_to_string(error.code), error.line, error.column, error.offset);
+    }
+    return tokens;
+}
+
+CleksTokens* Cleks_lex(char *buffer, size_t buffer_size, CleksConfig config)
+{
+    CleksCompiledConfig *compiled = Cleks_compile_config(config);
+    if (compiled == NULL) return NULL;
+    CleksTokens *tokens = Cleks_lex_compiled(buffer, buffer_size, compiled);
+    Cleks_free_compiled_config(compiled);
+    return tokens;
+}
+
+/* Incremental lexing */
+
+// the number of bytes after a token the lexer may have read to end it
+static size_t cleks_lookahead(CleksCompiledConfig *compiled)
+{
+    size_t lookahead = 1;
+    for (size_t i=0; i<compiled->config.custom_token_count; ++i){
+        const char *long_symbol = compiled->config.custom_tokens[i].long_symbol;
+        if (long_symbol != NULL && strlen(long_symbol) > lookahead) lookahead = strlen(long_symbol);
+    }
+    return lookahead;
+}
+
+// whether the old tokens from old_start on can be kept, as only the first of their errors and the end of all are known
+// they are kept with all or none of the errors, but not behind a failed allocation which may succeed now
+static bool cleks_keeps_errors(CleksTokens *tokens, size_t old_start, CleksErrorPolicy policy)
+{
+    if (old_start >= tokens->error_end) return true;
+    if (old_start > tokens->clean_size) return false;
+    return tokens->error_end != SIZE_MAX || (policy != CLEKS_ON_ERROR_RECOVER && tokens->error_code != CLEKS_ERROR_ALLOCATION);
+}
+
+static bool cleks_relex(CleksTokens *tokens, CleksCompiledConfig *compiled, size_t edit_offset, size_t removed_length, char *new_buffer, size_t new_buffer_size, CleksErrorPolicy policy, CleksError *error, CleksInternTable *interns)
+{
+    if (edit_offset > tokens->buffer_size || removed_length > tokens->buffer_size - edit_offset || new_buffer_size < tokens->buffer_size - removed_length){
+        // the tokens are left as they were, the edit has no location in the new buffer
+        *error = (CleksError){.code=CLEKS_ERROR_INVALID_EDIT, .offset=0, .line=1, .column=1, .count=1};
+        return false;
+    }
+    size_t inserted_length = new_buffer_size + removed_length - tokens->buffer_size;
+    // the tokens before first were lexed without reading the edited bytes, and without
+    // recovering from an error, as an unclosed string may be closed by the edit
+    size_t lookahead = cleks_lookahead(compiled);
+    size_t limit = edit_offset < tokens->clean_size ? edit_offset : tokens->clean_size;
+    size_t first = 0, high = tokens->size;
+    while (first < high){
+        size_t mid = first + (high - first)/2;
+        if (cleks_token_end(&tokens->items[mid]) + lookahead <= limit) first = mid+1;
+        else high = mid;
+    }
+    size_t start = first > 0 ? cleks_token_end(&tokens->items[first-1]) : 0;
+    Clekser clekser = {.buffer=new_buffer, .buffer_size=new_buffer_size, .index=start, .eof=true, .comment=CLEKS_NOT_FOUND, .allocator=&tokens->value_allocator, .interns=interns};
+    CleksToken *lexed = NULL;
+    size_t lexed_size = 0, lexed_capacity = 0;
+    size_t last = first; // the first old token kept after the edit
+    // the errors of the new buffer, recorded like cleks_note_error as the tokens are only changed at the end
+    CleksErrorCode error_code = CLEKS_OK;
+    size_t error_count = 0, clean_size = new_buffer_size, error_end = 0;
+    bool synced = false, completed = true;
+    CleksToken token;
+    CleksStep step;
+    while ((step = Cleks_lex_step(&clekser, compiled, &token)) != CLEKS_STEP_END){
+        if (step == CLEKS_STEP_TOKEN){
+            size_t token_start = cleks_token_start(&token);
+            if (token_start >= edit_offset + inserted_length){
+                // both streams continue identically from a token starting at the same place behind the edit
+                size_t old_start = token_start - inserted_length + removed_length;
+                while (last < tokens->size && cleks_token_start(&tokens->items[last]) < old_start) last += 1;
+                if (last < tokens->size && cleks_token_start(&tokens->items[last]) == old_start && cleks_keeps_errors(tokens, old_start, policy)){
+                    cleks_free_token_value(tokens, &token);
+                    synced = true;
+                    break;
+                }
+            }
+            if (lexed_size >= lexed_capacity){
+                size_t new_capacity = lexed_capacity > 0 ? lexed_capacity*CLEKS_TOKENS_RESIZE_FACTOR : 16;
+                CleksToken *new_lexed = (CleksToken*) Cleks_realloc(&tokens->allocator, lexed, lexed_capacity*sizeof(CleksToken), new_capacity*sizeof(CleksToken));
+                if (new_lexed == NULL){
+                    cleks_free_token_value(tokens, &token);
+                    cleks_fail(&clekser, CLEKS_ERROR_ALLOCATION, token_start);
+                    cleks_report_error(error, &clekser, 0, 1, 0);
+                    if (error_count++ == 0){
+                        clean_size = token_start;
+                        error_code = CLEKS_ERROR_ALLOCATION;
+                    }
+                    error_end = SIZE_MAX;
+                    completed = false;
+                    break;
+                }
+                lexed = new_lexed;
+                lexed_capacity = new_capacity;
+            }
+            lexed[lexed_size++] = token;
+        }
+        else if (step == CLEKS_STEP_ERROR){
+            bool stopped = policy != CLEKS_ON_ERROR_RECOVER || clekser.error == CLEKS_ERROR_ALLOCATION;
+            cleks_report_error(error, &clekser, 0, 1, 0);
+            if (error_count++ == 0){
+                clean_size = clekser.error_offset;
+                error_code = clekser.error;
+            }
+            error_end = stopped ? SIZE_MAX : clekser.error_offset + 1;
+            if (stopped){
+                completed = false;
+                break;
+            }
+            // resynchronize at the start of the next line
+            const char *newline = (const char*) memchr(new_buffer + clekser.error_offset, '\n', new_buffer_size - clekser.error_offset);
+            clekser.index = newline != NULL ? (size_t) (newline - new_buffer) + 1 : new_buffer_size;
+        }
+    }
+    if (synced && cleks_token_start(&tokens->items[last]) < tokens->error_end){
+        // the kept tokens hold all old errors, which are reported again behind the edit
+        size_t shifted = tokens->clean_size + inserted_length - removed_length;
+        cleks_fail(&clekser, tokens->error_code, shifted);
+        cleks_report_error(error, &clekser, 0, 1, 0);
+        error->count += tokens->error_count - 1;
+        if (error_count == 0){
+            clean_size = shifted;
+            error_code = tokens->error_code;
+        }
+        error_count += tokens->error_count;
+        error_end = tokens->error_end != SIZE_MAX ? tokens->error_end + inserted_length - removed_length : SIZE_MAX;
+        if (tokens->error_end == SIZE_MAX) completed = false;
+    }
+    if (!synced) last = tokens->size;
+    size_t new_size = tokens->size - (last - first) + lexed_size;
+    if (new_size > tokens->capacity && (completed || policy != CLEKS_ON_ERROR_FREE)){
+        CleksToken *new_items = (CleksToken*) Cleks_realloc(&tokens->allocator, tokens->items, tokens->capacity*sizeof(CleksToken), new_size*sizeof(CleksToken));
+        if (new_items == NULL){
+            cleks_fail(&clekser, CLEKS_ERROR_ALLOCATION, start);
+            cleks_report_error(error, &clekser, 0, 1, 0);
+            completed = false;
+            policy = CLEKS_ON_ERROR_FREE;
+        }
+        else{
+            tokens->items = new_items;
+            tokens->capacity = new_size;
+        }
+    }
+    if (!completed && policy == CLEKS_ON_ERROR_FREE){
+        // the tokens are left as they were
+        for (size_t i=0; i<lexed_size; ++i) cleks_free_token_value(tokens, &lexed[i]);
+        Cleks_free(&tokens->allocator, lexed);
+        return false;
+    }
+    tokens->clean_size = clean_size;
+    tokens->error_code = error_code;
+    tokens->error_count = error_count;
+    tokens->error_end = error_end;
+    // splice the lexed tokens in place of the affected ones and move the rest behind the edit
+    for (size_t i=first; i<last; ++i) cleks_free_token_value(tokens, &tokens->items[i]);
+    if (first + lexed_size != last) memmove(tokens->items + first + lexed_size, tokens->items + last, (tokens->size - last)*sizeof(CleksToken));
+    if (lexed_size > 0) memcpy(tokens->items + first, lexed, lexed_size*sizeof(CleksToken));
+    if (inserted_length != removed_length){
+        for (size_t i=first+lexed_size; i<new_size; ++i) tokens->items[i].offset = tokens->items[i].offset + inserted_length - removed_length;
+    }
+    tokens->size = new_size;
+    Cleks_free(&tokens->allocator, lexed);
+    // the old buffer is no longer referenced
+    cleks_release_mapping(tokens);
+    Cleks_free_line_index(&tokens->lines);
+    tokens->buffer = new_buffer;
+    tokens->buffer_size = new_buffer_size;
+    return completed;
+}
+
+bool Cleks_relex(CleksTokens *tokens, CleksCompiledConfig *compiled, size_t edit_offset, size_t removed_length, char *new_buffer, size_t new_buffer_size, CleksErrorPolicy policy, CleksError *error)
+{
+    cleks_assert(tokens != NULL && compiled != NULL && (new_buffer != NULL || new_buffer_size == 0), "Invalid arguments!");
+    CleksError local_error;
+    if (error == NULL) error = &local_error;
+    memset(error, 0, sizeof(*error));
+    return cleks_relex(tokens, compiled, edit_offset, removed_length, new_buffer, new_buffer_size, policy, error, NULL);
+}
+
+int Cleks_lex_visit_compiled(char *buffer, size_t buffer_size, CleksCompiledConfig *compiled, CleksVisitFn on_token, void *user, CleksError *error)
+{
+    cleks_assert((buffer != NULL || buffer_size == 0) && compiled != NULL && on_token != NULL, "Invalid arguments!");
+    if (error != NULL) memset(error, 0, sizeof(*error));
+    Clekser clekser = {.buffer=buffer, .buffer_size=buffer_size, .index=0, .eof=true, .comment=CLEKS_NOT_FOUND};
+    CleksToken token;
+    CleksStep step;
+    while ((step = Cleks_lex_step(&clekser, compiled, &token)) != CLEKS_STEP_END){
+        if (step == CLEKS_STEP_TOKEN){
+            int result = on_token(&token, buffer, user);
+            // values only exist without CLEKS_FLAG_SPANS and are only valid during the callback
+            Cleks_free(NULL, token.value);
+            if (result != 0) return result;
+        }
+        else if (step == CLEKS_STEP_ERROR){
+            if (error != NULL) cleks_report_error(error, &clekser, 0, 1, 0);
+            return 0;
+        }
+    }
+    return 0;
+}
+
+int Cleks_lex_visit(char *buffer, size_t buffer_size, CleksConfig config, CleksVisitFn on_token, void *user)
+{
+    // visited tokens are never stored, therefore only reference the buffer
+    config.flags |= CLEKS_FLAG_SPANS;
+    CleksCompiledConfig *compiled = Cleks_compile_config(config);
+    if (compiled == NULL) return 0;
+    CleksError error;
+    int result = Cleks_lex_visit_compiled(buffer, buffer_size, compiled, on_token, user, &error);
+    if (error.code != CLEKS_OK){
+        cleks_error("[PARSING] %s at %zu:%zu (index %zu)!", Cleks_error_to_string(error.code), error.line, error.column, error.offset);
+    }
+    Cleks_free_compiled_config(compiled);
+    return result;
+}
+
+// maps a whole file into memory (reads it without mmap), quiet does not print failures
+static bool cleks_map_file(const char *path, void **mapping, size_t *size, bool quiet)
+{
+    *mapping = NULL;
+    *size = 0;
+#ifdef CLEKS_HAS_MMAP
+    int fd = open(path, O_RDONLY);
+    if (fd == -1){
+        if (!quiet) cleks_error("Failed to open file '%s'!", path);
+        return false;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == -1){
+        close(fd);
+        if (!quiet) cleks_error("Failed to stat file '%s'!", path);
+        return false;
+    }
+    *size = (size_t) file_stat.st_size;
+    if (*size > 0){
+        *mapping = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (*mapping == MAP_FAILED){
+            *mapping = NULL;
+            close(fd);
+            if (!quiet) cleks_error("Failed to map file '%s'!", path);
+            return false;
+        }
+        madvise(*mapping, *size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+#else
+    FILE *file = fopen(path, "rb");
+    if (file == NULL){
+        if (!quiet) cleks_error("Failed to open file '%s'!", path);
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    *size = file_size > 0 ? (size_t) file_size : 0;
+    if (*size > 0){
+        *mapping = malloc(*size);
+        if (*mapping == NULL || fread(*mapping, 1, *size, file) != *size){
+            free(*mapping);
+            *mapping = NULL;
+            fclose(file);
+            if (!quiet) cleks_error("Failed to read file '%s'!", path);
+            return false;
+        }
+    }
+    fclose(file);
+#endif // CLEKS_HAS_MMAP
+    return true;
+}
+
+static void cleks_unmap_file(void *mapping, size_t size)
+{
+    if (mapping == NULL) return;
+#ifdef CLEKS_HAS_MMAP
+    munmap(mapping, size);
+#else
+    (void) size;
+    free(mapping);
+#endif // CLEKS_HAS_MMAP
+}
+
+CleksTokens* Cleks_lex_file_compiled(const char *path, CleksCompiledConfig *compiled)
+{
+    cleks_assert(path != NULL && compiled != NULL, "Invalid arguments!");
+    void *mapping;
+    size_t size;
+    if (!cleks_map_file(path, &mapping, &size, false)) return NULL;
+    CleksTokens *tokens = Cleks_lex_compiled((char*) mapping, size, compiled);
+    if (tokens == NULL){
+        cleks_unmap_file(mapping, size);
+        return NULL;
+    }
+    tokens->mapping = mapping;
+    tokens->mapping_size = size;
+    return tokens;
+}
+
+CleksTokens* Cleks_lex_file(const char *path, CleksConfig config)
+{
+    CleksCompiledConfig *compiled = Cleks_compile_config(config);
+    if (compiled == NULL) return NULL;
+    CleksTokens *tokens = Cleks_lex_file_compiled(path, compiled);
+    Cleks_free_compiled_config(compiled);
+    return tokens;
+}
+
+/* Serialization */
+
+// The serialized tokens start with a header of CLEKS_TOKENS_HEADER_SIZE bytes: the magic "CLEKSTOK" followed by
+// the little-endian 64-bit format version, config fingerprint, input hash, input size, token count, clean size,
+// first error code, error count and error end.
+// Every token follows as varints: its type plus CLEKS_TOKEN_COUNT shifted left by one, with the lowest bit set if
+// a flags byte follows, the distance of its start from the end of the previous token and its length. Integers add
+// their zigzag encoded value, floats their 8 bytes.
+
+static void cleks_fingerprint_add(uint64_t *hash, const char *s, size_t n)
+{
+    // FNV-1a, continued from hash and terminated by a zero byte, so that consecutive strings do not run together
+    for (size_t i=0; i<n; ++i){
+        *hash ^= (uint8_t) s[i];
+        *hash *= 0x100000001b3ULL;
+    }
+    *hash *= 0x100000001b3ULL;
+}
+
+static void cleks_fingerprint_string(uint64_t *hash, const char *s)
+{
+    cleks_fingerprint_add(hash, s != NULL ? s : "", s != NULL ? strlen(s) : 0);
+}
+
+// a hash of everything in the config that changes the tokens (the names of the tokens do not)
+static uint64_t cleks_config_fingerprint(CleksConfig *config)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    char bytes[4] = {(char) CLEKS_TOKENS_FORMAT_VERSION, (char) config->flags, (char) config->default_token_count, 0};
+    cleks_fingerprint_add(&hash, bytes, sizeof(bytes));
+    cleks_fingerprint_string(&hash, config->whitespaces);
+    for (size_t i=0; i<config->custom_token_count; ++i){
+        CleksTokenConfig *token = &config->custom_tokens[i];
+        char symbol[2] = {token->symbol, (char) token->coalesce};
+        cleks_fingerprint_add(&hash, symbol, sizeof(symbol));
+        cleks_fingerprint_string(&hash, token->word);
+        cleks_fingerprint_string(&hash, token->long_symbol);
+    }
+    for (size_t i=0; i<config->string_count; ++i){
+        char dels[2] = {config->strings[i].start_del, config->strings[i].end_del};
+        cleks_fingerprint_add(&hash, dels, sizeof(dels));
+    }
+    for (size_t i=0; i<config->comment_count; ++i){
+        cleks_fingerprint_string(&hash, config->comments[i].start_del);
+        cleks_fingerprint_string(&hash, config->comments[i].end_del);
+    }
+    return hash;
+}
+
+static size_t cleks_put_varint(uint8_t *out, uint64_t value)
+{
+    size_t n = 0;
+    for (; value >= 0x80; value >>= 7) out[n++] = (uint8_t) (value | 0x80);
+    out[n++] = (uint8_t) value;
+    return n;
+}
+
+static bool cleks_get_varint(const uint8_t **p, const uint8_t *end, uint64_t *value)
+{
+    *value = 0;
+    for (unsigned shift=0; shift<64 && *p < end; shift += 7){
+        uint8_t byte = *(*p)++;
+        *value |= (uint64_t) (byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+static void cleks_put_u64(uint8_t *out, uint64_t value)
+{
+    for (size_t i=0; i<8; ++i) out[i] = (uint8_t) (value >> 8*i);
+}
+
+static uint64_t cleks_get_u64(const uint8_t *p)
+{
+    uint64_t value = 0;
+    for (size_t i=0; i<8; ++i) value |= (uint64_t) p[i] << 8*i;
+    return value;
+}
+
+bool Cleks_tokens_serialize(CleksTokens *tokens, FILE *out)
+{
+    cleks_assert(tokens != NULL && out != NULL, "Invalid arguments: tokens=%p, out=%p", tokens, out);
+    uint8_t header[CLEKS_TOKENS_HEADER_SIZE];
+    memcpy(header, "CLEKSTOK", 8);
+    cleks_put_u64(header + 8, CLEKS_TOKENS_FORMAT_VERSION);
+    cleks_put_u64(header + 16, cleks_config_fingerprint(&tokens->config));
+    cleks_put_u64(header + 24, cleks_hash_input(tokens->buffer, tokens->buffer_size));
+    cleks_put_u64(header + 32, tokens->buffer_size);
+    cleks_put_u64(header + 40, tokens->size);
+    cleks_put_u64(header + 48, tokens->clean_size);
+    cleks_put_u64(header + 56, (uint64_t) tokens->error_code);
+    cleks_put_u64(header + 64, tokens->error_count);
+    cleks_put_u64(header + 72, tokens->error_end);
+    if (fwrite(header, 1, sizeof(header), out) != sizeof(header)) return false;
+    // the tokens are encoded into a chunk, which is written whenever it may not hold the next token
+    uint8_t chunk[64*1024];
+    size_t size = 0, previous_end = 0;
+    for (size_t i=0; i<tokens->size; ++i){
+        CleksToken *token = &tokens->items[i];
+        uint8_t flags = token->flags & ~CLEKS_TOKEN_FLAG_INTERNED;
+        size_t start = cleks_token_start(token);
+        size += cleks_put_varint(chunk + size, (uint64_t) (token->type + CLEKS_TOKEN_COUNT) << 1 | (flags != 0));
+        if (flags != 0) chunk[size++] = flags;
+        size += cleks_put_varint(chunk + size, start - previous_end);
+        size += cleks_put_varint(chunk + size, token->length);
+        if (token->type == CLEKS_INT){
+            size += cleks_put_varint(chunk + size, ((uint64_t) token->int_value << 1) ^ (uint64_t) (token->int_value >> 63));
+        }
+        else if (token->type == CLEKS_FLOAT){
+            uint64_t bits;
+            memcpy(&bits, &token->float_value, sizeof(bits));
+            cleks_put_u64(chunk + size, bits);
+            size += 8;
+        }
+        previous_end = cleks_token_end(token);
+        // a token takes at most 3 varints, a flags byte and 8 value bytes
+        if (size > sizeof(chunk) - 48 || i+1 == tokens->size){
+            if (fwrite(chunk, 1, size, out) != size) return false;
+            size = 0;
+        }
+    }
+    return true;
+}
+
+CleksTokens* Cleks_tokens_load(const void *data, size_t data_size, char *buffer, size_t buffer_size, CleksConfig config)
+{
+    cleks_assert((data != NULL || data_size == 0) && (buffer != NULL || buffer_size == 0), "Invalid arguments!");
+    const uint8_t *p = (const uint8_t*) data, *end = p + data_size;
+    // stale or foreign data is rejected before any token is decoded
+    if (data_size < CLEKS_TOKENS_HEADER_SIZE || memcmp(p, "CLEKSTOK", 8) != 0) return NULL;
+    if (cleks_get_u64(p + 8) != CLEKS_TOKENS_FORMAT_VERSION || cleks_get_u64(p + 16) != cleks_config_fingerprint(&config)) return NULL;
+    if (cleks_get_u64(p + 32) != buffer_size || cleks_get_u64(p + 24) != cleks_hash_input(buffer, buffer_size)) return NULL;
+    uint64_t count = cleks_get_u64(p + 40);
+    // every token takes at least 3 bytes
+    if (count > (data_size - CLEKS_TOKENS_HEADER_SIZE)/3) return NULL;
+    CleksTokens *tokens = Cleks_create_tokens(count > 0 ? (size_t) count : 1, config);
+    if (tokens == NULL) return NULL;
+    tokens->buffer = buffer;
+    tokens->buffer_size = buffer_size;
+    tokens->clean_size = (size_t) cleks_get_u64(p + 48);
+    tokens->error_code = (CleksErrorCode) cleks_get_u64(p + 56);
+    tokens->error_count = (size_t) cleks_get_u64(p + 64);
+    tokens->error_end = (size_t) cleks_get_u64(p + 72);
+    p += CLEKS_TOKENS_HEADER_SIZE;
+    bool values = (config.flags & CLEKS_FLAG_SPANS) == 0;
+    size_t previous_end = 0;
+    for (uint64_t i=0; i<count; ++i){
+        CleksToken *token = &tokens->items[tokens->size];
+        uint64_t head, distance, length;
+        memset(token, 0, sizeof(*token));
+        if (!cleks_get_varint(&p, end, &head)) goto corrupted;
+        token->type = (CleksTokenType) (head >> 1) - CLEKS_TOKEN_COUNT;
+        if (head & 1){
+            if (p >= end) goto corrupted;
+            token->flags = *p++;
+        }
+        // interned values are never stored, and a token of an unknown type would be printed out of bounds
+        if ((token->flags & CLEKS_TOKEN_FLAG_INTERNED) || (head >> 1) >= (uint64_t) config.custom_token_count + CLEKS_TOKEN_COUNT) goto corrupted;
+        if (!cleks_get_varint(&p, end, &distance) || !cleks_get_varint(&p, end, &length)) goto corrupted;
+        // the token and the delimiters of a string have to fit the buffer, checked before any sum may wrap around
+        size_t delimiters = token->type == CLEKS_STRING ? 2 : 0;
+        if (distance > buffer_size - previous_end) goto corrupted;
+        size_t start = previous_end + (size_t) distance;
+        if (buffer_size - start < delimiters || length > buffer_size - start - delimiters) goto corrupted;
+        token->offset = token->type == CLEKS_STRING ? start + 1 : start;
+        token->length = (size_t) length;
+        previous_end = cleks_token_end(token);
+        if (token->type == CLEKS_INT){
+            uint64_t zigzag;
+            if (!cleks_get_varint(&p, end, &zigzag)) goto corrupted;
+            token->int_value = (int64_t) (zigzag >> 1) ^ -(int64_t) (zigzag & 1);
+        }
+        else if (token->type == CLEKS_FLOAT){
+            if (end - p < 8) goto corrupted;
+            uint64_t bits = cleks_get_u64(p);
+            memcpy(&token->float_value, &bits, sizeof(bits));
+            p += 8;
+        }
+        tokens->size += 1;
+        // the values of default tokens are copied from the input like when lexing
+        if (values && token->type < 0){
+            if (token->type == CLEKS_STRING && (token->flags & CLEKS_TOKEN_FLAG_ESCAPES)){
+                token->value = (char*) Cleks_alloc(&tokens->value_allocator, token->length+1);
+                if (token->value != NULL) cleks_unescape(buffer + token->offset, token->length, token->value, token->length+1, token->flags & CLEKS_TOKEN_FLAG_UNICODE);
+            }
+            else token->value = cleks_strndup(&tokens->value_allocator, buffer + token->offset, token->length);
+            if (token->value == NULL) goto corrupted;
+        }
+    }
+    if (p == end) return tokens;
+corrupted:
+    Cleks_free_tokens(tokens);
+    return NULL;
+}
+
+// returns the tokens of the file from cache_dir if they were stored for the same input and config, otherwise
+// lexes the file and stores its tokens in cache_dir, which must exist
+CleksTokens* Cleks_lex_file_cached(const char *path, CleksCompiledConfig *compiled, const char *cache_dir)
+{
+    cleks_assert(path != NULL && compiled != NULL && cache_dir != NULL, "Invalid arguments!");
+    void *mapping;
+    size_t size;
+    if (!cleks_map_file(path, &mapping, &size, false)) return NULL;
+    // cache entries are named by their content, so renamed and copied files share them
+    char cache_path[4096];
+    int length = snprintf(cache_path, sizeof(cache_path), "%s/%016llx-%016llx.cleks", cache_dir,
+                          (unsigned long long) cleks_hash_input((const char*) mapping, size),
+                          (unsigned long long) cleks_config_fingerprint(&compiled->config));
+    bool cacheable = length > 0 && (size_t) length < sizeof(cache_path);
+    CleksTokens *tokens = NULL;
+    void *cached;
+    size_t cached_size;
+    if (cacheable && cleks_map_file(cache_path, &cached, &cached_size, true)){
+        tokens = Cleks_tokens_load(cached, cached_size, (char*) mapping, size, compiled->config);
+        cleks_unmap_file(cached, cached_size);
+    }
+    if (tokens == NULL){
+        tokens = Cleks_lex_compiled((char*) mapping, size, compiled);
+        if (tokens == NULL){
+            cleks_unmap_file(mapping, size);
+            return NULL;
+        }
+        if (cacheable){
+            // written to a temporary file first, so that readers never see a partial entry
+            char temp_path[sizeof(cache_path)];
+#ifdef CLEKS_HAS_UNISTD
+            length = snprintf(temp_path, sizeof(temp_path), "%s.%ld.tmp", cache_path, (long) getpid());
+#else
+            length = snprintf(temp_path, sizeof(temp_path), "%s.tmp", cache_path);
+#endif // CLEKS_HAS_UNISTD
+            // a truncated name could be another file, the tokens are returned uncached then
+            FILE *out = length > 0 && (size_t) length < sizeof(temp_path) ? fopen(temp_path, "wb") : NULL;
+            if (out != NULL){
+                bool written = Cleks_tokens_serialize(tokens, out);
+                written &= fclose(out) == 0;
+                if (!written || rename(temp_path, cache_path) != 0) remove(temp_path);
+            }
+        }
+    }
+    tokens->mapping = mapping;
+    tokens->mapping_size = size;
+    return tokens;
+}
+
+/* Reusable lexer context */
+
+CleksLexer* Cleks_create_lexer(CleksCompiledConfig *compiled, size_t capacity, CleksAllocator *allocator)
+{
+    cleks_assert(compiled != NULL, "Invalid arguments!");
+    CleksLexer *lexer = (CleksLexer*) Cleks_alloc(allocator, sizeof(*lexer));
+    if (lexer == NULL) return NULL;
+    memset(lexer, 0, sizeof(*lexer));
+    if (allocator != NULL) lexer->allocator = *allocator;
+    lexer->compiled = compiled;
+    lexer->policy = CLEKS_ON_ERROR_FREE;
+    Cleks_init_arena(&lexer->arena, 0, &lexer->allocator);
+    if (!cleks_init_tokens(&lexer->tokens, capacity, compiled->config, &lexer->allocator)){
+        Cleks_free(allocator, lexer);
+        return NULL;
+    }
+    lexer->tokens.value_allocator = Cleks_arena_allocator(&lexer->arena);
+    return lexer;
+}
+
+void Cleks_reset_lexer(CleksLexer *lexer)
+{
+    if (lexer == NULL) return;
+    // the token buffer and the arena blocks are kept for the next input
+    lexer->tokens.size = 0;
+    lexer->tokens.buffer = NULL;
+    lexer->tokens.buffer_size = 0;
+    Cleks_free_line_index(&lexer->tokens.lines);
+#ifdef CLEKS_STATS
+    memset(&lexer->tokens.stats, 0, sizeof(lexer->tokens.stats));
+#endif // CLEKS_STATS
+    Cleks_reset_arena(&lexer->arena);
+}
+
+CleksTokens* Cleks_lexer_lex(CleksLexer *lexer, char *buffer, size_t buffer_size)
+{
+    cleks_assert(lexer != NULL && (buffer != NULL || buffer_size == 0), "Invalid arguments!");
+    Cleks_reset_lexer(lexer);
+    memset(&lexer->error, 0, sizeof(lexer->error));
+    if (!cleks_lex_into(&lexer->tokens, buffer, buffer_size, lexer->compiled, lexer->policy, &lexer->error, lexer->interns) && lexer->policy == CLEKS_ON_ERROR_FREE){
+        Cleks_reset_lexer(lexer);
+        return NULL;
+    }
+    return &lexer->tokens;
+}
+
+CleksTokens* Cleks_lexer_relex(CleksLexer *lexer, size_t edit_offset, size_t removed_length, char *new_buffer, size_t new_buffer_size)
+{
+    cleks_assert(lexer != NULL && (new_buffer != NULL || new_buffer_size == 0), "Invalid arguments!");
+    memset(&lexer->error, 0, sizeof(lexer->error));
+    if (!cleks_relex(&lexer->tokens, lexer->compiled, edit_offset, removed_length, new_buffer, new_buffer_size, lexer->policy, &lexer->error, lexer->interns) && lexer->policy == CLEKS_ON_ERROR_FREE){
+        return NULL;
+    }
+    return &lexer->tokens;
+}
+
+void Cleks_free_lexer(CleksLexer *lexer)
+{
+    if (lexer == NULL) return;
+    CleksAllocator allocator = lexer->allocator;
+    Cleks_free(&allocator, lexer->tokens.items);
+    Cleks_free_line_index(&lexer->tokens.lines);
+    Cleks_free_arena(&lexer->arena);
+    Cleks_free(&allocator, lexer);
+}
+
+void Cleks_free_batch(CleksBatch *batch);
+
+/* Parallel lexing */
+
+typedef struct{
+    char *buffer;
+    size_t buffer_size;
+    CleksCompiledConfig *compiled;
+    size_t start;       // where the chunk's lexer starts (a guess of a token boundary)
+    size_t stop;        // the lexer stops at the first step starting at or after stop
+    size_t end;         // where the chunk's lexer stopped
+    CleksTokens *tokens;
+} CleksChunk;
+
+#ifdef CLEKS_HAS_THREADS
+static void* cleks_lex_chunk(void *arg)
+{
+    CleksChunk *chunk = (CleksChunk*) arg;
+    chunk->tokens = Cleks_create_tokens(16, chunk->compiled->config);
+    if (chunk->tokens == NULL) return NULL;
+    // the chunk may have started inside a token, therefore never treat the end of the buffer as final
+    Clekser clekser = {.buffer=chunk->buffer, .buffer_size=chunk->buffer_size, .index=chunk->start, .eof=false, .comment=CLEKS_NOT_FOUND, .allocator=&chunk->tokens->value_allocator};
+    CleksToken token;
+    while (true){
+        size_t step_start = clekser.index;
+        if (step_start >= chunk->stop){
+            chunk->end = step_start;
+            break;
+        }
+        CleksStep step = Cleks_lex_step(&clekser, chunk->compiled, &token);
+        if (step == CLEKS_STEP_TOKEN){
+            // the serial lexer continues where the chunk could not keep its tokens
+            if (!cleks_push_token(chunk->tokens, &token)){
+                chunk->end = step_start;
+                break;
+            }
+        }
+        else if (step == CLEKS_STEP_MORE || step == CLEKS_STEP_END || step == CLEKS_STEP_ERROR){
+            // a chunk starting inside a string may fail on bytes that are no string at all,
+            // so whether an error is real is left to the serial lexer continuing at the end
+            chunk->end = step_start;
+            break;
+        }
+    }
+#ifdef CLEKS_STATS
+    cleks_merge_stats(&chunk->tokens->stats, &clekser.stats);
+#endif // CLEKS_STATS
+    return NULL;
+}
+#endif // CLEKS_HAS_THREADS
+
+CleksTokens* Cleks_lex_parallel(char *buffer, size_t buffer_size, CleksCompiledConfig *compiled, size_t nthreads)
+{
+    cleks_assert((buffer != NULL || buffer_size == 0) && compiled != NULL, "Invalid arguments!");
+    if (nthreads > buffer_size / CLEKS_PARALLEL_MIN_CHUNK) nthreads = buffer_size / CLEKS_PARALLEL_MIN_CHUNK;
+#ifndef CLEKS_HAS_THREADS
+    nthreads = 1;
+#endif // CLEKS_HAS_THREADS
+    if (nthreads <= 1) return Cleks_lex_compiled(buffer, buffer_size, compiled);
+
+    CleksChunk *chunks = (CleksChunk*) calloc(nthreads, sizeof(CleksChunk));
+    if (chunks == NULL) return Cleks_lex_compiled(buffer, buffer_size, compiled);
+    for (size_t i=0; i<nthreads; ++i){
+        size_t start = buffer_size / nthreads * i;
+        // starting right after a whitespace makes it likely to start at a token boundary
+        if (i > 0){
+            size_t limit = buffer_size / nthreads * (i+1);
+            while (start < limit && (compiled->classes[(uint8_t) buffer[start-1]] & CLEKS_CLASS_WHITESPACE) == 0) start += 1;
+            chunks[i-1].stop = start;
+        }
+        chunks[i] = (CleksChunk){.buffer=buffer, .buffer_size=buffer_size, .compiled=compiled, .start=start, .stop=buffer_size};
+    }
+#ifdef CLEKS_HAS_THREADS
+    pthread_t *threads = (pthread_t*) calloc(nthreads, sizeof(pthread_t));
+    bool *started = (bool*) calloc(nthreads, sizeof(bool));
+    for (size_t i=1; threads != NULL && started != NULL && i<nthreads; ++i){
+        started[i] = pthread_create(&threads[i], NULL, cleks_lex_chunk, &chunks[i]) == 0;
+    }
+    cleks_lex_chunk(&chunks[0]);
+    for (size_t i=1; i<nthreads; ++i){
+        // chunks whose thread could not be started are lexed serially
+        if (started != NULL && started[i]) pthread_join(threads[i], NULL);
+        else cleks_lex_chunk(&chunks[i]);
+    }
+    free(started);
+    free(threads);
+#endif // CLEKS_HAS_THREADS
+
+    // lexing errors in a chunk are found again by the serial lexer, only a missing chunk aborts
+    bool allocated = true;
+    size_t total = 0;
+    for (size_t i=0; i<nthreads; ++i){
+        if (chunks[i].tokens != NULL) total += chunks[i].tokens->size;
+        else allocated = false;
+    }
+    CleksTokens *tokens = allocated ? Cleks_create_tokens(total, compiled->config) : NULL;
+    if (tokens == NULL) cleks_error("Failed to allocate tokens!");
+    else{
+        tokens->buffer = buffer;
+        tokens->buffer_size = buffer_size;
+        cleks_clear_errors(tokens);
+        // the first chunk starts at a true token boundary, every following chunk is
+        // only used from the first token at which the verified lexer agrees with it
+        Clekser clekser = {.buffer=buffer, .buffer_size=buffer_size, .index=0, .eof=true, .comment=CLEKS_NOT_FOUND, .allocator=&tokens->value_allocator};
+        size_t j = 0;
+        while (true){
+            CleksChunk *chunk = j < nthreads ? &chunks[j] : NULL;
+            if (chunk != NULL && clekser.index == chunk->start){
+                size_t k = 0;
+                for (; k<chunk->tokens->size; ++k){
+                    CleksToken *slot = Cleks_append_token(tokens, chunk->tokens->items[k].type, chunk->tokens->items[k].value);
+                    if (slot == NULL) break;
+                    *slot = chunk->tokens->items[k];
+                }
+                // the values of the copied tokens are owned by tokens now
+                memmove(chunk->tokens->items, chunk->tokens->items + k, (chunk->tokens->size - k)*sizeof(CleksToken));
+                chunk->tokens->size -= k;
+                if (chunk->tokens->size > 0){
+                    cleks_error("Failed to resize CleksTokens!");
+                    Cleks_free_tokens(tokens);
+                    tokens = NULL;
+                    break;
+                }
+                clekser.index = chunk->end;
+                j += 1;
+                continue;
+            }
+            CleksToken token;
+            CleksStep step = Cleks_lex_step(&clekser, compiled, &token);
+            if (step == CLEKS_STEP_END) break;
+            if (step == CLEKS_STEP_ERROR){
+                CleksError error = {0};
+                cleks_report_error(&error, &clekser, 0, 1, 0);
+                cleks_error("[PARSING] %s at %zu:%zu (index %zu)!", Cleks_error_to_string(error.code), error.line, error.column, error.offset);
+                Cleks_free_tokens(tokens);
+                tokens = NULL;
+                break;
+            }
+            if (step != CLEKS_STEP_TOKEN) continue;
+            // skip chunks the verified lexer has already passed
+            size_t token_start = cleks_token_start(&token);
+            while (chunk != NULL && (chunk->tokens->size == 0 || cleks_token_start(&chunk->tokens->items[chunk->tokens->size-1]) < token_start)){
+                chunk = ++j < nthreads ? &chunks[j] : NULL;
+            }
+            if (chunk != NULL && token_start >= chunk->start){
+                // binary search for a token of the chunk starting at the same position
+                size_t lo = 0, hi = chunk->tokens->size;
+                while (lo < hi){
+                    size_t mid = lo + (hi-lo)/2;
+                    if (cleks_token_start(&chunk->tokens->items[mid]) < token_start) lo = mid+1;
+                    else hi = mid;
+                }
+                if (lo < chunk->tokens->size && cleks_token_start(&chunk->tokens->items[lo]) == token_start){
+                    // both lexers are at the same token boundary: the rest of the chunk is valid
+                    cleks_free_token_value(tokens, &token);
+                    for (size_t k=0; k<lo; ++k) cleks_free_token_value(chunk->tokens, &chunk->tokens->items[k]);
+                    memmove(chunk->tokens->items, chunk->tokens->items + lo, (chunk->tokens->size - lo)*sizeof(CleksToken));
+                    chunk->tokens->size -= lo;
+                    chunk->start = token_start;
+                    clekser.index = token_start;
+                    continue;
+                }
+            }
+            if (!cleks_push_token(tokens, &token)){
+                cleks_error("Failed to resize CleksTokens!");
+                Cleks_free_tokens(tokens);
+                tokens = NULL;
+                break;
+            }
+        }
+#ifdef CLEKS_STATS
+        if (tokens != NULL){
+            // the work of all threads is accounted for, but only the resulting tokens are counted
+            for (size_t i=0; i<nthreads; ++i) cleks_merge_stats(&tokens->stats, &chunks[i].tokens->stats);
+            cleks_merge_stats(&tokens->stats, &clekser.stats);
+            tokens->stats.bytes = buffer_size;
+            tokens->stats.tokens = 0;
+            tokens->stats.other_tokens = 0;
+            memset(tokens->stats.token_counts, 0, sizeof(tokens->stats.token_counts));
+            for (size_t i=0; i<tokens->size; ++i) cleks_count_token(&tokens->stats, tokens->items[i].type);
+        }
+#endif // CLEKS_STATS
+    }
+    for (size_t i=0; i<nthreads; ++i){
+        Cleks_free_tokens(chunks[i].tokens);
+    }
+    free(chunks);
+    return tokens;
+}
+
+/* Batch lexing */
+
+typedef struct CleksBatchJob CleksBatchJob;
+
+typedef struct{
+    CleksBatchJob *job;
+    size_t id;
+    size_t next;        // the next input of the worker's range
+    size_t end;         // the end of the worker's range, lowered by thieves
+#ifdef CLEKS_HAS_THREADS
+    pthread_mutex_t lock; // guards next and end
+#endif // CLEKS_HAS_THREADS
+} CleksBatchWorker;
+
+struct CleksBatchJob{
+    char **buffers;
+    size_t *sizes;
+    CleksCompiledConfig *compiled;
+    CleksBatch *batch;
+    CleksBatchWorker *workers;
+    size_t worker_count;
+};
+
+#ifdef CLEKS_HAS_THREADS
+#define CLEKS_BATCH_LOCK(worker) pthread_mutex_lock(&(worker)->lock)
+#define CLEKS_BATCH_UNLOCK(worker) pthread_mutex_unlock(&(worker)->lock)
+#else
+#define CLEKS_BATCH_LOCK(worker) ((void) 0)
+#define CLEKS_BATCH_UNLOCK(worker) ((void) 0)
+#endif // CLEKS_HAS_THREADS
+
+// takes the next input of the worker's range, or steals the back half of the largest remaining range
+static bool cleks_batch_take(CleksBatchJob *job, CleksBatchWorker *worker, size_t *index)
+{
+    CLEKS_BATCH_LOCK(worker);
+    bool taken = worker->next < worker->end;
+    if (taken) *index = worker->next++;
+    CLEKS_BATCH_UNLOCK(worker);
+    while (!taken){
+        CleksBatchWorker *victim = NULL;
+        size_t most = 0;
+        for (size_t i=0; i<job->worker_count; ++i){
+            CleksBatchWorker *other = &job->workers[i];
+            CLEKS_BATCH_LOCK(other);
+            size_t left = other->end - other->next;
+            CLEKS_BATCH_UNLOCK(other);
+            if (left > most){
+                most = left;
+                victim = other;
+            }
+        }
+        if (victim == NULL) return false;
+        // the victim may have taken its last inputs since, then the search starts over
+        CLEKS_BATCH_LOCK(victim);
+        size_t left = victim->end - victim->next;
+        size_t stolen_end = victim->end;
+        victim->end -= left - left/2;
+        size_t stolen_start = victim->end;
+        CLEKS_BATCH_UNLOCK(victim);
+        if (stolen_start == stolen_end) continue;
+        CLEKS_BATCH_LOCK(worker);
+        worker->next = stolen_start + 1;
+        worker->end = stolen_end;
+        CLEKS_BATCH_UNLOCK(worker);
+        *index = stolen_start;
+        taken = true;
+    }
+    return true;
+}
+
+static void* cleks_batch_work(void *arg)
+{
+    CleksBatchWorker *worker = (CleksBatchWorker*) arg;
+    CleksBatchJob *job = worker->job;
+    CleksBatch *batch = job->batch;
+    CleksArena *arena = &batch->arenas[worker->id];
+    // every input is lexed into the same scratch tokens, which are copied into the arena at their final size
+    CleksTokens scratch;
+    if (!cleks_init_tokens(&scratch, 64, job->compiled->config, NULL)) scratch.items = NULL;
+    scratch.value_allocator = Cleks_arena_allocator(arena);
+    size_t index;
+    while (cleks_batch_take(job, worker, &index)){
+        CleksTokens *tokens = &batch->tokens[index];
+        CleksError *error = &batch->errors[index];
+        if (scratch.items == NULL){
+            *error = (CleksError){.code=CLEKS_ERROR_ALLOCATION, .offset=0, .line=1, .column=1, .count=1};
+            continue;
+        }
+        scratch.size = 0;
+#ifdef CLEKS_STATS
+        memset(&scratch.stats, 0, sizeof(scratch.stats));
+#endif // CLEKS_STATS
+        bool completed = cleks_lex_into(&scratch, job->buffers[index], job->sizes[index], job->compiled, batch->policy, error, NULL);
+        if (!completed && batch->policy == CLEKS_ON_ERROR_FREE) continue;
+        memcpy(tokens, &scratch, sizeof(scratch));
+        tokens->items = (CleksToken*) Cleks_arena_alloc(arena, (scratch.size > 0 ? scratch.size : 1)*sizeof(CleksToken));
+        if (tokens->items == NULL){
+            *error = (CleksError){.code=CLEKS_ERROR_ALLOCATION, .offset=0, .line=1, .column=1, .count=1};
+            memset(tokens, 0, sizeof(*tokens));
+            continue;
+        }
+        memcpy(tokens->items, scratch.items, scratch.size*sizeof(CleksToken));
+        tokens->capacity = scratch.size;
+        // the tokens are owned by the batch, only a line index is allocated later on
+        memset(&tokens->allocator, 0, sizeof(tokens->allocator));
+    }
+    Cleks_free(NULL, scratch.items);
+    return NULL;
+}
+
+CleksBatch* Cleks_lex_batch(char **buffers, size_t *sizes, size_t count, CleksCompiledConfig *compiled, size_t nthreads, CleksErrorPolicy policy)
+{
+    cleks_assert((buffers != NULL && sizes != NULL) || count == 0, "Invalid arguments!");
+    cleks_assert(compiled != NULL, "Invalid compiled config!");
+    if (nthreads > count) nthreads = count;
+    if (nthreads == 0) nthreads = 1;
+#ifndef CLEKS_HAS_THREADS
+    nthreads = 1;
+#endif // CLEKS_HAS_THREADS
+    CleksBatch *batch = (CleksBatch*) calloc(1, sizeof(CleksBatch));
+    CleksBatchWorker *workers = (CleksBatchWorker*) calloc(nthreads, sizeof(CleksBatchWorker));
+    if (batch == NULL || workers == NULL){
+        free(batch);
+        free(workers);
+        return NULL;
+    }
+    batch->count = count;
+    batch->policy = policy;
+    batch->arena_count = nthreads;
+    batch->tokens = (CleksTokens*) calloc(count > 0 ? count : 1, sizeof(CleksTokens));
+    batch->errors = (CleksError*) calloc(count > 0 ? count : 1, sizeof(CleksError));
+    batch->arenas = (CleksArena*) calloc(nthreads, sizeof(CleksArena));
+    if (batch->tokens == NULL || batch->errors == NULL || batch->arenas == NULL){
+        free(workers);
+        Cleks_free_batch(batch);
+        return NULL;
+    }
+    CleksBatchJob job = {.buffers=buffers, .sizes=sizes, .compiled=compiled, .batch=batch, .workers=workers, .worker_count=nthreads};
+    // every worker starts with a range of about the same number of bytes
+    size_t total = 0;
+    for (size_t i=0; i<count; ++i) total += sizes[i];
+    size_t index = 0, bytes = 0;
+    for (size_t w=0; w<nthreads; ++w){
+        Cleks_init_arena(&batch->arenas[w], 0, NULL);
+        workers[w] = (CleksBatchWorker){.job=&job, .id=w, .next=index};
+        size_t target = w+1 == nthreads ? total : total / nthreads * (w+1);
+        while (index < count && (bytes < target || w+1 == nthreads)) bytes += sizes[index++];
+        workers[w].end = index;
+#ifdef CLEKS_HAS_THREADS
+        pthread_mutex_init(&workers[w].lock, NULL);
+#endif // CLEKS_HAS_THREADS
+    }
+#ifdef CLEKS_HAS_THREADS
+    pthread_t *threads = (pthread_t*) calloc(nthreads, sizeof(pthread_t));
+    bool *started = (bool*) calloc(nthreads, sizeof(bool));
+    for (size_t i=1; threads != NULL && started != NULL && i<nthreads; ++i){
+        started[i] = pthread_create(&threads[i], NULL, cleks_batch_work, &workers[i]) == 0;
+    }
+    // the inputs of workers whose thread could not be started are stolen by the others
+    cleks_batch_work(&workers[0]);
+    for (size_t i=1; i<nthreads; ++i){
+        if (started != NULL && started[i]) pthread_join(threads[i], NULL);
+    }
+    free(started);
+    free(threads);
+    for (size_t w=0; w<nthreads; ++w) pthread_mutex_destroy(&workers[w].lock);
+#else
+    cleks_batch_work(&workers[0]);
+#endif // CLEKS_HAS_THREADS
+    free(workers);
+    return batch;
+}
+
+// returns the tokens of an input, NULL if lexing it failed with CLEKS_ON_ERROR_FREE
+CleksTokens* Cleks_batch_tokens(CleksBatch *batch, size_t index)
+{
+    if (batch == NULL || index >= batch->count || batch->tokens[index].items == NULL) return NULL;
+    return &batch->tokens[index];
+}
+
+void Cleks_free_batch(CleksBatch *batch)
+{
+    if (batch == NULL) return;
+    for (size_t i=0; batch->tokens != NULL && i<batch->count; ++i) Cleks_free_line_index(&batch->tokens[i].lines);
+    for (size_t i=0; batch->arenas != NULL && i<batch->arena_count; ++i) Cleks_free_arena(&batch->arenas[i]);
+    free(batch->arenas);
+    free(batch->errors);
+    free(batch->tokens);
+    free(batch);
+}
+
+/* Streaming */
+
+static size_t cleks_read_file(void *user, char *buffer, size_t size)
+{
+    return fread(buffer, 1, size, (FILE*) user);
+}
+
+#ifdef CLEKS_HAS_UNISTD
+static size_t cleks_read_fd(void *user, char *buffer, size_t size)
+{
+    int fd = (int) (intptr_t) user;
+    ssize_t n;
+    do{
+        n = read(fd, buffer, size);
+    } while (n < 0 && errno == EINTR);
+    return n > 0 ? (size_t) n : 0;
+}
+#endif // CLEKS_HAS_UNISTD
+
+CleksStream* Cleks_create_stream(CleksCompiledConfig *compiled, CleksReadFn read, void *user, size_t chunk_size)
+{
+    cleks_assert(compiled != NULL && read != NULL && chunk_size != 0, "Invalid arguments!");
+    CleksStream *stream = (CleksStream*) calloc(1, sizeof(*stream));
+    if (stream == NULL) return NULL;
+    stream->buffer = (char*) malloc(chunk_size);
+    if (stream->buffer == NULL){
+        free(stream);
+        return NULL;
+    }
+    stream->compiled = compiled;
+    stream->read = read;
+    stream->user = user;
+    stream->capacity = chunk_size;
+    stream->chunk_size = chunk_size;
+    stream->line = 1;
+    stream->clekser = (Clekser){.buffer=stream->buffer, .buffer_size=0, .index=0, .eof=false, .comment=CLEKS_NOT_FOUND};
+    return stream;
+}
+
+CleksStream* Cleks_stream_file(FILE *file, CleksCompiledConfig *compiled, size_t chunk_size)
+{
+    cleks_assert(file != NULL, "Invalid file!");
+    return Cleks_create_stream(compiled, cleks_read_file, file, chunk_size);
+}
+
+#ifdef CLEKS_HAS_UNISTD
+CleksStream* Cleks_stream_fd(int fd, CleksCompiledConfig *compiled, size_t chunk_size)
+{
+    cleks_assert(fd >= 0, "Invalid file descriptor!");
+    return Cleks_create_stream(compiled, cleks_read_fd, (void*) (intptr_t) fd, chunk_size);
+}
+#endif // CLEKS_HAS_UNISTD
+
+void Cleks_free_stream(CleksStream *stream)
+{
+    if (stream != NULL){
+        free(stream->buffer);
+        free(stream);
+    }
+}
+
+static bool cleks_stream_fill(CleksStream *stream)
+{
+    Clekser *clekser = &stream->clekser;
+    // drop everything before the current token
+    size_t kept = clekser->buffer_size - clekser->index;
+    // keep track of the lines of the dropped input for error reporting
+    cleks_count_lines(stream->buffer, clekser->index, stream->base, &stream->line, &stream->line_start);
+    // a long token stays at the start of the buffer, which is then only extended
+    if (clekser->index > 0) memmove(stream->buffer, stream->buffer + clekser->index, kept);
+    stream->base += clekser->index;
+    clekser->index = 0;
+    clekser->buffer_size = kept;
+    if (stream->capacity - kept < stream->chunk_size){
+        size_t new_capacity = stream->capacity * CLEKS_TOKENS_RESIZE_FACTOR;
+        while (new_capacity - kept < stream->chunk_size) new_capacity *= CLEKS_TOKENS_RESIZE_FACTOR;
+        char *new_buffer = (char*) realloc(stream->buffer, new_capacity);
+        if (new_buffer == NULL){
+            cleks_fail(clekser, CLEKS_ERROR_ALLOCATION, 0);
+            return false;
+        }
+        stream->buffer = new_buffer;
+        stream->capacity = new_capacity;
+        clekser->buffer = new_buffer;
+    }
+    size_t n = stream->read(stream->user, stream->buffer + kept, stream->chunk_size);
+    clekser->buffer_size += n;
+    CLEKS_STAT(clekser->stats, bytes, n);
+    if (n == 0) clekser->eof = true;
+    return true;
+}
+
+bool Cleks_next_token(CleksStream *stream, CleksToken *token)
+{
+    if (stream == NULL || token == NULL || stream->failed) return false;
+    while (true){
+        switch (Cleks_lex_step(&stream->clekser, stream->compiled, token)){
+            case CLEKS_STEP_TOKEN:{
+                token->offset += stream->base;
+                return true;
+            }
+            case CLEKS_STEP_MORE:{
+                if (!cleks_stream_fill(stream)){
+                    cleks_report_error(&stream->error, &stream->clekser, stream->base, stream->line, stream->line_start);
+                    stream->failed = true;
+                    return false;
+                }
+            } break;
+            case CLEKS_STEP_END: return false;
+            case CLEKS_STEP_ERROR:{
+                cleks_report_error(&stream->error, &stream->clekser, stream->base, stream->line, stream->line_start);
+                stream->failed = true;
+                return false;
+            }
+            default: break;
+        }
+    }
+}
+
+const char* Cleks_stream_span(CleksStream *stream, CleksToken *token)
+{
+    // only valid until the next call to Cleks_next_token
+    if (stream == NULL || token == NULL || token->offset < stream->base) return NULL;
+    return stream->buffer + (token->offset - stream->base);
+}
+
+char* Cleks_token_to_string(CleksToken *token, CleksConfig config)
+{
+    if (token == NULL || !CLEKS_TOKEN_IS_VALID(token)) return NULL;
+    if (CLEKS_TOKEN_IS_CUSTOM(token) && token->type < config.custom_token_count){
+        return config.custom_tokens[token->type].print_string;
+    }
+    return config.default_tokens[token->type+config.default_token_count].print_string;
+}
+
+void cleks_print_token(CleksToken *token, CleksConfig config, const char *buffer)
+{
+    if (!CLEKS_TOKEN_IS_VALID(token) || token->type >= (int) config.custom_token_count){
+        cleks_error("Invalid token: token: %p, type: %d", token, (int) token->type);
+        return;
+    }
+    printf("Token % 3d: %s", token->type, Cleks_token_to_string(token, config));
+    if (CLEKS_TOKEN_IS_CUSTOM(token) && config.custom_tokens[token->type].coalesce && token->length > 1){
+        printf(" x%zu", token->length);
+    }
+    if (token->value != NULL){
+        printf(" \"%s\"", token->value);
+    }
+    else if (!CLEKS_TOKEN_IS_CUSTOM(token) && buffer != NULL){
+        printf(" \"%.*s\"", (int) token->length, buffer + token->offset);
+    }
+    putchar('\n');
+}
+
+void Cleks_print_tokens(CleksTokens *tokens)
+{
+    if (tokens == NULL){
+        cleks_error("Invalid tokens given!");
+        return;
+    }
+    printf("Token count: %u\n  ", tokens->size);
+    for (size_t i=0; i<tokens->size; ++i){
+        cleks_print_token(&tokens->items[i], tokens->config, tokens->buffer);
+        printf("  ");
+    }
+    putchar('\n');
+}
+
+#ifdef CLEKS_STATS
+void Cleks_print_stats(CleksStats *stats, CleksConfig config)
+{
+    if (stats == NULL){
+        cleks_error("Invalid stats given!");
+        return;
+    }
+    printf("Bytes: %zu (strings: %zu, comments: %zu, whitespaces: %zu)\n", stats->bytes, stats->string_bytes, stats->comment_bytes, stats->whitespace_bytes);
+    printf("Tokens: %zu\n", stats->tokens);
+    for (size_t i=0; i<CLEKS_ARR_LEN(stats->token_counts); ++i){
+        if (stats->token_counts[i] == 0) continue;
+        CleksToken token = {.type=(CleksTokenType) i - CLEKS_TOKEN_COUNT};
+        printf("  %s: %zu\n", Cleks_token_to_string(&token, config), stats->token_counts[i]);
+    }
+    if (stats->other_tokens > 0) printf("  Other: %zu\n", stats->other_tokens);
+    printf("Escape sequences: %zu\n", stats->escapes);
+    printf("Allocations: %zu (%zu bytes, %zu token buffer regrowths)\n", stats->allocations, stats->allocated_bytes, stats->regrowths);
+#ifdef CLEKS_STATS_TIMERS
+    static const char *phases[CLEKS_PHASE_COUNT] = {"strings", "comments", "words", "numbers"};
+    for (size_t i=0; i<CLEKS_PHASE_COUNT; ++i){
+        printf("Time in %s: %llu\n", phases[i], (unsigned long long) stats->cycles[i]);
+    }
+#endif // CLEKS_STATS_TIMERS
+}
+#endif // CLEKS_STATS
+
+/* Code generation */
+
+static void cleks_gen_byte(FILE *out, uint8_t byte)
+{
+    // printable characters as literals, everything else as its value
+    if (byte == '\n') fputs("'\\n'", out);
+    else if (byte == '\t') fputs("'\\t'", out);
+    else if (byte == '\r') fputs("'\\r'", out);
+    else if (byte == '\0') fputs("'\\0'", out);
+    else if (byte == '\'' || byte == '\\') fprintf(out, "'\\%c'", byte);
+    else if (byte >= 0x20 && byte < 0x7f) fprintf(out, "'%c'", byte);
+    else fprintf(out, "%u", byte);
+}
+
+static void cleks_gen_string(FILE *out, const char *s)
+{
+    if (s == NULL){
+        fputs("NULL", out);
+        return;
+    }
+    fputc('"', out);
+    for (; *s != '\0'; ++s){
+        uint8_t c = (uint8_t) *s;
+        if (c == '"' || c == '\\' || c == '?') fprintf(out, "\\%c", c);
+        else if (c == '\n') fputs("\\n", out);
+        else if (c == '\t') fputs("\\t", out);
+        else if (c == '\r') fputs("\\r", out);
+        else if (c >= 0x20 && c < 0x7f) fputc(c, out);
+        else fprintf(out, "\\%03o", c);
+    }
+    fputc('"', out);
+}
+
+static void cleks_gen_token_configs(FILE *out, const char *prefix, const char *name, CleksTokenConfig *tokens, size_t count)
+{
+    if (count == 0) return;
+    fprintf(out, "static CleksTokenConfig %s_%s[] = {\n", prefix, name);
+    for (size_t i=0; i<count; ++i){
+        fputs("    {", out);
+        cleks_gen_string(out, tokens[i].print_string);
+        fputs(", ", out);
+        cleks_gen_string(out, tokens[i].word);
+        fputs(", ", out);
+        cleks_gen_byte(out, (uint8_t) tokens[i].symbol);
+        fputs(", ", out);
+        cleks_gen_string(out, tokens[i].long_symbol);
+        fputs(tokens[i].coalesce ? ", true" : ", false", out);
+        fputs(i+1 < count ? "},\n" : "}\n", out);
+    }
+    fputs("};\n\n", out);
+}
+
+static void cleks_gen_config(FILE *out, const char *prefix, CleksConfig config)
+{
+    cleks_gen_token_configs(out, prefix, "default_tokens", config.default_tokens, config.default_token_count);
+    cleks_gen_token_configs(out, prefix, "custom_tokens", config.custom_tokens, config.custom_token_count);
+    if (config.string_count > 0){
+        fprintf(out, "static CleksString %s_strings[] = {\n", prefix);
+        for (size_t i=0; i<config.string_count; ++i){
+            fputs("    {", out);
+            cleks_gen_byte(out, (uint8_t) config.strings[i].start_del);
+            fputs(", ", out);
+            cleks_gen_byte(out, (uint8_t) config.strings[i].end_del);
+            fputs(i+1 < config.string_count ? "},\n" : "}\n", out);
+        }
+        fputs("};\n\n", out);
+    }
+    if (config.comment_count > 0){
+        fprintf(out, "static CleksComment %s_comments[] = {\n", prefix);
+        for (size_t i=0; i<config.comment_count; ++i){
+            fputs("    {", out);
+            cleks_gen_string(out, config.comments[i].start_del);
+            fputs(", ", out);
+            cleks_gen_string(out, config.comments[i].end_del);
+            fputs(i+1 < config.comment_count ? "},\n" : "}\n", out);
+        }
+        fputs("};\n\n", out);
+    }
+    fprintf(out, "CleksConfig %s_config = {\n", prefix);
+    if (config.default_token_count > 0) fprintf(out, "    .default_tokens = %s_default_tokens,\n", prefix);
+    fprintf(out, "    .default_token_count = %zu,\n", config.default_token_count);
+    if (config.custom_token_count > 0) fprintf(out, "    .custom_tokens = %s_custom_tokens,\n", prefix);
+    fprintf(out, "    .custom_token_count = %zu,\n", config.custom_token_count);
+    fputs("    .whitespaces = ", out);
+    cleks_gen_string(out, config.whitespaces);
+    fputs(",\n", out);
+    if (config.string_count > 0) fprintf(out, "    .strings = %s_strings,\n", prefix);
+    fprintf(out, "    .string_count = %zu,\n", config.string_count);
+    if (config.comment_count > 0) fprintf(out, "    .comments = %s_comments,\n", prefix);
+    fprintf(out, "    .comment_count = %zu,\n", config.comment_count);
+    fprintf(out, "    .flags = 0x%x\n};\n\n", config.flags);
+}
+
+static void cleks_gen_trie_node(FILE *out, CleksTrie *trie, uint32_t node, size_t length, int indent)
+{
+    // longer keys are tried first, so the deepest match returns
+    for (uint32_t child = trie->nodes[node].child; child != 0; child = trie->nodes[child].sibling){
+        fprintf(out, "%*sif (end - p > %zu && (uint8_t) p[%zu] == ", indent, "", length, length);
+        cleks_gen_byte(out, trie->nodes[child].byte);
+        fputs("){\n", out);
+        cleks_gen_trie_node(out, trie, child, length+1, indent+4);
+        fprintf(out, "%*s}\n", indent, "");
+    }
+    if (trie->nodes[node].value != CLEKS_NOT_FOUND){
+        fprintf(out, "%*s*value = %d;\n", indent, "", trie->nodes[node].value);
+        fprintf(out, "%*sreturn %zu;\n", indent, "", length);
+    }
+}
+
+static void cleks_gen_trie(FILE *out, const char *prefix, const char *name, CleksTrie *trie)
+{
+    if (trie->nodes == NULL) return;
+    fprintf(out, "// returns the length of the longest %s at p, 0 if there is none\n", name);
+    fprintf(out, "static inline size_t %s_match_%s(const char *p, const char *end, int *value)\n{\n", prefix, name);
+    fputs("    switch ((uint8_t) *p){\n", out);
+    for (size_t byte=0; byte<256; ++byte){
+        if (trie->roots[byte] == 0) continue;
+        fputs("        case ", out);
+        cleks_gen_byte(out, (uint8_t) byte);
+        fputs(":\n", out);
+        cleks_gen_trie_node(out, trie, trie->roots[byte], 1, 12);
+        fputs("            break;\n", out);
+    }
+    fputs("    }\n    return 0;\n}\n\n", out);
+}
+
+static void cleks_gen_keywords(FILE *out, const char *prefix, CleksConfig config)
+{
+    size_t max_length = 0;
+    for (size_t i=0; i<config.custom_token_count; ++i){
+        if (config.custom_tokens[i].word != NULL && strlen(config.custom_tokens[i].word) > max_length) max_length = strlen(config.custom_tokens[i].word);
+    }
+    if (max_length == 0) return;
+    fprintf(out, "static inline int %s_keyword(const char *s, size_t n)\n{\n    switch (n){\n", prefix);
+    for (size_t length=1; length<=max_length; ++length){
+        bool first = true;
+        for (size_t i=0; i<config.custom_token_count; ++i){
+            // earlier definitions take precedence over duplicates
+            const char *word = config.custom_tokens[i].word;
+            if (word == NULL || strlen(word) != length) continue;
+            if (first) fprintf(out, "        case %zu:\n", length);
+            first = false;
+            fputs("            if (memcmp(s, ", out);
+            cleks_gen_string(out, word);
+            fprintf(out, ", %zu) == 0) return %zu;\n", length, i);
+        }
+        if (!first) fputs("            break;\n", out);
+    }
+    fputs("    }\n    return CLEKS_NOT_FOUND;\n}\n\n", out);
+}
+
+// the part of a byte's class deciding what the lexer does with it
+static uint32_t cleks_gen_action(CleksCompiledConfig *compiled, uint8_t byte)
+{
+    uint8_t class = compiled->classes[byte];
+    if (class & CLEKS_CLASS_STRING) return CLEKS_CLASS_STRING | (uint32_t) (uint8_t) compiled->string_ends[byte] << 8;
+    if (class & CLEKS_CLASS_SYMBOL) return (class & (CLEKS_CLASS_LONG_SYMBOL | CLEKS_CLASS_SYMBOL | CLEKS_CLASS_COALESCE)) | (uint32_t) compiled->symbols[byte] << 8;
+    if (class & CLEKS_CLASS_WHITESPACE) return class & (CLEKS_CLASS_LONG_SYMBOL | CLEKS_CLASS_WHITESPACE);
+    return class;
+}
+
+static void cleks_gen_cases(FILE *out, CleksCompiledConfig *compiled, bool (*match)(CleksCompiledConfig *compiled, uint8_t byte, uint32_t action), uint32_t action, int indent)
+{
+    fprintf(out, "%*s", indent, "");
+    bool first = true;
+    for (size_t byte=0; byte<256; ++byte){
+        if (!match(compiled, (uint8_t) byte, action)) continue;
+        fputs(first ? "case " : " case ", out);
+        cleks_gen_byte(out, (uint8_t) byte);
+        fputc(':', out);
+        first = false;
+    }
+    fputc('\n', out);
+}
+
+static bool cleks_gen_same_action(CleksCompiledConfig *compiled, uint8_t byte, uint32_t action)
+{
+    return cleks_gen_action(compiled, byte) == action;
+}
+
+static bool cleks_gen_is_whitespace(CleksCompiledConfig *compiled, uint8_t byte, uint32_t action)
+{
+    (void) action;
+    return compiled->classes[byte] & CLEKS_CLASS_WHITESPACE;
+}
+
+static bool cleks_gen_ends_word(CleksCompiledConfig *compiled, uint8_t byte, uint32_t action)
+{
+    return (compiled->classes[byte] & CLEKS_CLASS_WORD_END) ? action == CLEKS_CLASS_WORD_END : (compiled->classes[byte] & action) != 0;
+}
+
+bool Cleks_generate(FILE *out, CleksConfig config, const char *prefix)
+{
+    cleks_assert(out != NULL && prefix != NULL, "Invalid arguments: out=%p, prefix=%p", out, prefix);
+    for (const char *c = prefix; *c != '\0'; ++c){
+        if (!isalnum((unsigned char) *c) && *c != '_'){
+            cleks_error("Invalid prefix '%s', it must be a C identifier!", prefix);
+            return false;
+        }
+    }
+    CleksCompiledConfig *compiled = Cleks_compile_config(config);
+    if (compiled == NULL) return false;
+    bool spans = config.flags & CLEKS_FLAG_SPANS;
+    bool has_strings = false, has_symbols = false, has_whitespaces = false, has_comments = false;
+    for (size_t byte=0; byte<256; ++byte){
+        has_strings |= (compiled->classes[byte] & CLEKS_CLASS_STRING) != 0;
+        has_symbols |= (compiled->classes[byte] & (CLEKS_CLASS_SYMBOL | CLEKS_CLASS_LONG_SYMBOL)) != 0;
+        has_whitespaces |= (compiled->classes[byte] & CLEKS_CLASS_WHITESPACE) != 0;
+        has_comments |= (compiled->classes[byte] & CLEKS_CLASS_COMMENT) != 0;
+    }
+    bool numbers = (config.flags & (CLEKS_FLAG_NO_INTEGERS | CLEKS_FLAG_NO_FLOATS)) != (CLEKS_FLAG_NO_INTEGERS | CLEKS_FLAG_NO_FLOATS);
+    bool ignore_words = config.flags & CLEKS_FLAG_IGNORE_UNKNOWN;
+    bool validate_strings = config.flags & (CLEKS_FLAG_VALIDATE_UTF8 | CLEKS_FLAG_JSON_ESCAPES);
+    // without numbers, every word that is not a custom word is ignored
+    bool word_values = !spans && !(ignore_words && !numbers);
+    bool has_errors = has_strings || word_values;
+
+    char guard[256];
+    size_t guard_len = (size_t) snprintf(guard, sizeof(guard), "_CLEKS_GEN_%s_H", prefix);
+    for (size_t i=0; i<guard_len && i<sizeof(guard); ++i) guard[i] = (char) toupper((unsigned char) guard[i]);
+    fputs("// Generated by Cleks_generate, do not edit.\n", out);
+    fprintf(out, "#ifndef %s\n#define %s\n", guard, guard);
+    fputs("#ifndef _CLEKS_H\n#include \"cleks.h\"\n#endif // _CLEKS_H\n\n", out);
+    cleks_gen_config(out, prefix, config);
+    cleks_gen_trie(out, prefix, "symbol", &compiled->symbol_trie);
+    if (has_comments) cleks_gen_trie(out, prefix, "comment", &compiled->comment_trie);
+    cleks_gen_keywords(out, prefix, config);
+
+    fputs("// returns false if lexing stopped at an error\n", out);
+    fprintf(out, "static bool %s_lex_into(CleksTokens *tokens, char *buffer, size_t buffer_size, CleksErrorPolicy policy, CleksError *error)\n{\n", prefix);
+    fputs("    Clekser clekser = {.buffer=buffer, .buffer_size=buffer_size, .index=0, .eof=true, .comment=CLEKS_NOT_FOUND, .allocator=&tokens->value_allocator};\n", out);
+    fputs("    const char *p = buffer, *end = buffer + buffer_size, *start;\n", out);
+    fputs("    CleksToken token;\n", out);
+    if (has_symbols) fputs("    int type;\n    size_t length;\n", out);
+    else if (has_comments) fputs("    size_t length;\n", out);
+    if (has_comments) fputs("    int comment;\n", out);
+    if (has_strings) fputs("    uint8_t flags;\n", out);
+    if (has_strings && validate_strings) fputs("    size_t string_end;\n", out);
+    if (!has_errors) fputs("    (void) policy;\n", out);
+    fputs("    tokens->buffer = buffer;\n    tokens->buffer_size = buffer_size;\n    cleks_clear_errors(tokens);\n", out);
+    fputs("next:\n    if (p >= end) return true;\n    start = p;\n    switch ((uint8_t) *p){\n", out);
+    bool done[256] = {0};
+    for (size_t byte=0; byte<256; ++byte){
+        uint32_t action = cleks_gen_action(compiled, (uint8_t) byte);
+        if (done[byte] || action == CLEKS_CLASS_NONE) continue;
+        for (size_t other=byte; other<256; ++other){
+            if (cleks_gen_action(compiled, (uint8_t) other) == action) done[other] = true;
+        }
+        cleks_gen_cases(out, compiled, cleks_gen_same_action, action, 8);
+        // the same precedence as Cleks_lex_step: strings, multi-character symbols, symbols, whitespaces, comments, words
+        if (action & CLEKS_CLASS_STRING){
+            fprintf(out, "            goto string_%u;\n", action >> 8);
+            continue;
+        }
+        if (action & CLEKS_CLASS_LONG_SYMBOL){
+            fprintf(out, "            if ((length = %s_match_symbol(p, end, &type)) > 0) goto symbol;\n", prefix);
+        }
+        if (action & CLEKS_CLASS_SYMBOL){
+            fprintf(out, "            type = %u;\n", action >> 8);
+            if (action & CLEKS_CLASS_COALESCE) fputs("            for (length = 1; (size_t) (end - p) > length && p[length] == p[0]; ++length);\n", out);
+            else fputs("            length = 1;\n", out);
+            fputs("            goto symbol;\n", out);
+        }
+        else if (action & CLEKS_CLASS_WHITESPACE){
+            fputs("            goto whitespace;\n", out);
+        }
+        else{
+            if (action & CLEKS_CLASS_COMMENT){
+                fprintf(out, "            if ((length = %s_match_comment(p, end, &comment)) > 0) goto comment;\n", prefix);
+            }
+            fputs("            goto word;\n", out);
+        }
+    }
+    fputs("        default:\n            goto word;\n    }\n", out);
+
+    if (has_symbols){
+        fputs("symbol:\n", out);
+        fputs("    token = (CleksToken){.type=type, .offset=(size_t) (p - buffer), .length=length};\n", out);
+        fputs("    p += length;\n    goto emit;\n", out);
+    }
+    if (has_whitespaces){
+        fputs("whitespace:\n    for (p += 1; p < end; ++p){\n        switch ((uint8_t) *p){\n", out);
+        cleks_gen_cases(out, compiled, cleks_gen_is_whitespace, 0, 12);
+        fputs("                continue;\n        }\n        break;\n    }\n    goto next;\n", out);
+    }
+    if (has_comments){
+        fputs("comment:\n    p += length;\n    switch (comment){\n", out);
+        for (size_t i=0; i<compiled->comment_count; ++i){
+            if (compiled->comments[i].start_len == 0 || compiled->comments[i].end_len == 0) continue;
+            fprintf(out, "        case %zu:\n            p = cleks_find_str(p, end, ", i);
+            cleks_gen_string(out, compiled->comments[i].end_del);
+            fprintf(out, ", %zu);\n", compiled->comments[i].end_len);
+            fprintf(out, "            if (p != end) p += %zu;\n            break;\n", compiled->comments[i].end_len);
+        }
+        fputs("    }\n    goto next;\n", out);
+    }
+    bool string_done[256] = {0};
+    for (size_t byte=0; byte<256; ++byte){
+        if ((compiled->classes[byte] & CLEKS_CLASS_STRING) == 0) continue;
+        uint8_t end_del = (uint8_t) compiled->string_ends[byte];
+        if (string_done[end_del]) continue;
+        string_done[end_del] = true;
+        fprintf(out, "string_%u:\n    flags = CLEKS_TOKEN_FLAG_NONE;\n", end_del);
+        if (validate_strings){
+            // validating strings is left to the lexer's own scanner
+            fputs("    if (cleks_scan_string(&clekser, (size_t) (p + 1 - buffer), (char) ", out);
+            cleks_gen_byte(out, end_del);
+            fprintf(out, ", 0x%x, &string_end, &flags) != CLEKS_STEP_TOKEN) goto error;\n    p = buffer + string_end;\n", config.flags);
+        }
+        else{
+            fputs("    for (p += 1;; p = end - p > 2 ? p + 2 : end){\n", out);
+            fputs("        p = cleks_find2(p, end, ", out);
+            cleks_gen_byte(out, end_del);
+            fputs(", '\\\\');\n", out);
+            fputs("        if (p == end){\n            cleks_fail(&clekser, CLEKS_ERROR_UNCLOSED_STRING, (size_t) (start - buffer));\n            goto error;\n        }\n", out);
+            fputs("        if ((uint8_t) *p == ", out);
+            cleks_gen_byte(out, end_del);
+            fputs(") break;\n        // the escaped character never closes the string\n        flags |= CLEKS_TOKEN_FLAG_ESCAPES;\n    }\n", out);
+        }
+        fputs("    token = (CleksToken){.type=CLEKS_STRING, .offset=(size_t) (start + 1 - buffer), .length=(size_t) (p - start - 1), .flags=flags};\n", out);
+        fputs("    p += 1;\n", out);
+        fputs(spans ? "    goto emit;\n" : "    goto string_value;\n", out);
+    }
+    if (has_strings && !spans){
+        fputs("string_value:\n", out);
+        fputs("    token.value = (char*) Cleks_alloc(&tokens->value_allocator, token.length+1);\n", out);
+        fputs("    if (token.value == NULL){\n        cleks_fail(&clekser, CLEKS_ERROR_ALLOCATION, (size_t) (start - buffer));\n        goto error;\n    }\n", out);
+        fputs("    if (flags & CLEKS_TOKEN_FLAG_ESCAPES) cleks_unescape(start + 1, token.length, token.value, token.length+1, flags & CLEKS_TOKEN_FLAG_UNICODE);\n", out);
+        fputs("    else{\n        memcpy(token.value, start + 1, token.length);\n        token.value[token.length] = '\\0';\n    }\n    goto emit;\n", out);
+    }
+
+    fputs("word:\n    for (p += 1; p < end; ++p){\n        switch ((uint8_t) *p){\n", out);
+    cleks_gen_cases(out, compiled, cleks_gen_ends_word, CLEKS_CLASS_WORD_END, 12);
+    fputs("                goto word_end;\n", out);
+    bool long_symbols = false;
+    for (size_t byte=0; byte<256; ++byte) long_symbols |= cleks_gen_ends_word(compiled, (uint8_t) byte, CLEKS_CLASS_LONG_SYMBOL);
+    if (long_symbols){
+        // only a complete multi-character symbol ends the word
+        cleks_gen_cases(out, compiled, cleks_gen_ends_word, CLEKS_CLASS_LONG_SYMBOL, 12);
+        fprintf(out, "                if (%s_match_symbol(p, end, &type) > 0) goto word_end;\n                break;\n", prefix);
+    }
+    fputs("        }\n    }\nword_end:\n", out);
+    fputs("    token = (CleksToken){.type=CLEKS_WORD, .offset=(size_t) (start - buffer), .length=(size_t) (p - start)};\n", out);
+    if (compiled->keyword_capacity > 0){
+        fprintf(out, "    if ((token.type = %s_keyword(start, token.length)) != CLEKS_NOT_FOUND) goto emit;\n", prefix);
+    }
+    if (numbers){
+        fprintf(out, "    token.type = cleks_parse_number(start, token.length, 0x%x, &token);\n", config.flags);
+        if (ignore_words) fputs("    if (token.type == CLEKS_WORD) goto next;\n", out);
+    }
+    else if (ignore_words){
+        fputs("    goto next;\n", out);
+    }
+    else if (compiled->keyword_capacity > 0){
+        fputs("    token.type = CLEKS_WORD;\n", out);
+    }
+    if (word_values){
+        fputs("    token.value = cleks_strndup(&tokens->value_allocator, (char*) start, token.length);\n", out);
+        fputs("    if (token.value == NULL){\n        cleks_fail(&clekser, CLEKS_ERROR_ALLOCATION, token.offset);\n        goto error;\n    }\n", out);
+    }
+    fputs("emit:\n", out);
+    fputs("    if (!cleks_push_token(tokens, &token)){\n", out);
+    fputs("        cleks_fail(&clekser, CLEKS_ERROR_ALLOCATION, cleks_token_start(&token));\n", out);
+    fputs("        cleks_note_error(tokens, error, &clekser, true);\n        return false;\n    }\n    goto next;\n", out);
+    if (has_errors){
+        fputs("error:\n    if (policy != CLEKS_ON_ERROR_RECOVER || clekser.error == CLEKS_ERROR_ALLOCATION){\n", out);
+        fputs("        cleks_note_error(tokens, error, &clekser, true);\n        return false;\n    }\n", out);
+        fputs("    cleks_note_error(tokens, error, &clekser, false);\n", out);
+        fputs("    // resynchronize at the start of the next line\n", out);
+        fputs("    p = (const char*) memchr(buffer + clekser.error_offset, '\\n', buffer_size - clekser.error_offset);\n", out);
+        fputs("    p = p != NULL ? p + 1 : end;\n    goto next;\n", out);
+    }
+    fputs("}\n\n", out);
+
+    fprintf(out, "CleksTokens* %s_lex_checked(char *buffer, size_t buffer_size, CleksErrorPolicy policy, CleksError *error)\n{\n", prefix);
+    fputs("    cleks_assert(buffer != NULL || buffer_size == 0, \"Invalid arguments!\");\n", out);
+    fputs("    CleksError local_error;\n    if (error == NULL) error = &local_error;\n    memset(error, 0, sizeof(*error));\n", out);
+    fprintf(out, "    CleksTokens *tokens = Cleks_create_tokens(16, %s_config);\n", prefix);
+    fputs("    if (tokens == NULL){\n        *error = (CleksError){.code=CLEKS_ERROR_ALLOCATION, .offset=0, .line=1, .column=1, .count=1};\n        return NULL;\n    }\n", out);
+    fprintf(out, "    if (!%s_lex_into(tokens, buffer, buffer_size, policy, error) && policy == CLEKS_ON_ERROR_FREE){\n", prefix);
+    fputs("        Cleks_free_tokens(tokens);\n        return NULL;\n    }\n    return tokens;\n}\n\n", out);
+
+    fprintf(out, "CleksTokens* %s_lex(char *buffer, size_t buffer_size)\n{\n", prefix);
+    fputs("    CleksError error;\n", out);
+    fprintf(out, "    CleksTokens *tokens = %s_lex_checked(buffer, buffer_size, CLEKS_ON_ERROR_FREE, &error);\n", prefix);
+    fputs("    if (tokens == NULL){\n", out);
+    fputs("        cleks_error(\"[PARSING] %s at %zu:%zu (index %zu)!\", Cleks_error_to_string(error.code), error.line, error.column, error.offset);\n", out);
+    fputs("    }\n    return tokens;\n}\n\n", out);
+    fprintf(out, "#endif // %s\n", guard);
+    Cleks_free_compiled_config(compiled);
+    return !ferror(out);
 }
 
 /* String helper functions */
 
-static char* cleks_strndup(char *s, size_t n)
+static char* cleks_strndup(CleksAllocator *allocator, char *s, size_t n)
 {
     if (s == NULL) return NULL;
-    char *n_str = (char*) calloc(n+1, sizeof(char));
+    char *n_str = (char*) Cleks_alloc(allocator, n+1);
     if (n_str != NULL){
-        strncpy(n_str, s, n);
+        memcpy(n_str, s, n);
+        n_str[n] = '\0';
     }
     return n_str;
 }
 
-static bool cleks_str_is_int(char* s)
+static size_t cleks_utf8_encode(unsigned code, char *out)
 {
-    if (!s) return false;
-    char c;
-    if (*s == '+' || *s == '-') s++;
-    if (*s == '\0') return false;
-    while ((c = *s++)){
-        if (!isdigit(c)) return false;
+    if (code < 0x80){
+        out[0] = (char) code;
+        return 1;
     }
-    return true;
+    if (code < 0x800){
+        out[0] = (char) (0xC0 | code >> 6);
+        out[1] = (char) (0x80 | (code & 0x3F));
+        return 2;
+    }
+    if (code < 0x10000){
+        out[0] = (char) (0xE0 | code >> 12);
+        out[1] = (char) (0x80 | (code >> 6 & 0x3F));
+        out[2] = (char) (0x80 | (code & 0x3F));
+        return 3;
+    }
+    out[0] = (char) (0xF0 | code >> 18);
+    out[1] = (char) (0x80 | (code >> 12 & 0x3F));
+    out[2] = (char) (0x80 | (code >> 6 & 0x3F));
+    out[3] = (char) (0x80 | (code & 0x3F));
+    return 4;
+}
+
+// decodes the character or escape sequence at src[*i] into out, advances *i behind it and returns the decoded length
+static size_t cleks_unescape_next(const char *src, size_t n, size_t *i, bool unicode, char out[4])
+{
+    char c = src[*i];
+    unsigned code, low;
+    if (unicode && c == '\\' && *i+1 < n && src[*i+1] == 'u' && cleks_hex4(src + *i + 2, src + n, &code) > 0){
+        // \uXXXX is decoded to UTF-8, a high surrogate together with the low surrogate escaped after it
+        *i += 6;
+        if (code >= 0xD800 && code <= 0xDBFF && *i+1 < n && src[*i] == '\\' && src[*i+1] == 'u' && cleks_hex4(src + *i + 2, src + n, &low) > 0 && low >= 0xDC00 && low <= 0xDFFF){
+            code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+            *i += 6;
+        }
+        return cleks_utf8_encode(code, out);
+    }
+    if (c == '\\' && *i+1 < n){
+        switch(src[++*i]){
+            case '\'': c = 0x27; break;
+            case '"':  c = 0x22; break;
+            case '?':  c = 0x3f; break;
+            case '\\': c = 0x5c; break;
+            case 'a':  c = 0x07; break;
+            case 'b':  c = 0x08; break;
+            case 'f':  c = 0x0c; break;
+            case 'n':  c = 0x0a; break;
+            case 'r':  c = 0x0d; break;
+            case 't':  c = 0x09; break;
+            case 'v':  c = 0x0b; break;
+            default:   c = src[*i]; break;
+        }
+    }
+    *i += 1;
+    out[0] = c;
+    return 1;
+}
+
+static size_t cleks_unescape(const char *src, size_t n, char *dst, size_t dst_size, bool unicode)
+{
+    // writes at most dst_size-1 characters and returns the full unescaped length
+    size_t length = 0;
+    for (size_t i=0; i<n;){
+        char decoded[4];
+        size_t decoded_length = cleks_unescape_next(src, n, &i, unicode, decoded);
+        for (size_t k=0; k<decoded_length; ++k, ++length){
+            if (dst != NULL && length+1 < dst_size) dst[length] = decoded[k];
+        }
+    }
+    if (dst != NULL && dst_size > 0) dst[length < dst_size ? length : dst_size-1] = '\0';
+    return length;
+}
+
+/* Number parsing */
+
+static const double cleks_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#ifdef CLEKS_HAS_USELOCALE
+static locale_t cleks_c_locale_value = (locale_t) 0;
+
+static void cleks_create_c_locale(void)
+{
+    cleks_c_locale_value = newlocale(LC_ALL_MASK, "C", (locale_t) 0);
+}
+
+// returns the C locale, created once and kept until the program ends, (locale_t) 0 if that failed
+static locale_t cleks_c_locale(void)
+{
+#ifdef CLEKS_HAS_THREADS
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, cleks_create_c_locale);
+#else
+    if (cleks_c_locale_value == (locale_t) 0) cleks_create_c_locale();
+#endif // CLEKS_HAS_THREADS
+    return cleks_c_locale_value;
+}
+#endif // CLEKS_HAS_USELOCALE
+
+static double cleks_parse_float_slow(const char *s, size_t n)
+{
+    // strtod is correctly rounded but depends on the locale's decimal point
+    const char *decimal_point = NULL;
+#ifdef CLEKS_HAS_USELOCALE
+    // only the calling thread switches to the C locale
+    locale_t c_locale = cleks_c_locale();
+    locale_t previous = c_locale != (locale_t) 0 ? uselocale(c_locale) : (locale_t) 0;
+    if (c_locale == (locale_t) 0) decimal_point = localeconv()->decimal_point;
+#else
+    decimal_point = localeconv()->decimal_point;
+#endif // CLEKS_HAS_USELOCALE
+    if (decimal_point == NULL || decimal_point[0] == '\0') decimal_point = ".";
+    // the decimal point may take several bytes
+    size_t point_len = strlen(decimal_point);
+    size_t size = n * point_len + 1;
+    char small[128];
+    char *str = size <= sizeof(small) ? small : (char*) malloc(size);
+    double value = NAN;
+    if (str != NULL){
+        size_t length = 0;
+        for (size_t i=0; i<n; ++i){
+            if (s[i] != '.') str[length++] = s[i];
+            else{
+                memcpy(str + length, decimal_point, point_len);
+                length += point_len;
+            }
+        }
+        str[length] = '\0';
+        value = strtod(str, NULL);
+        if (str != small) free(str);
+    }
+#ifdef CLEKS_HAS_USELOCALE
+    if (c_locale != (locale_t) 0) uselocale(previous);
+#endif // CLEKS_HAS_USELOCALE
+    return value;
+}
+
+// classifies and parses a word of the form [+-]digits[.digits][(e|E)[+-]digits] in a single pass
+static CleksTokenType cleks_parse_number(const char *s, size_t n, uint8_t config_flags, CleksToken *token)
+{
+    const char *p = s;
+    const char *end = s + n;
+    bool negative = false;
+    if (p < end && (*p == '+' || *p == '-')){
+        negative = *p == '-';
+        p += 1;
+    }
+    uint64_t mantissa = 0;     // the first 19 significant digits
+    int64_t exponent = 0;      // the decimal exponent of mantissa
+    size_t digits = 0;         // the number of significant digits in mantissa
+    bool truncated = false;    // whether non-zero digits did not fit into mantissa
+    uint64_t integer = 0;      // the exact value of integers
+    bool overflow = false;     // whether integer does not fit into 64 bits
+    size_t int_digits = 0, frac_digits = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p, ++int_digits){
+        uint64_t d = (uint64_t) (*p - '0');
+        if (integer > (UINT64_MAX - d) / 10) overflow = true;
+        else integer = integer*10 + d;
+        if (digits < 19){
+            mantissa = mantissa*10 + d;
+            if (mantissa != 0) digits += 1;
+        }
+        else{
+            exponent += 1;
+            truncated |= d != 0;
+        }
+    }
+    bool is_float = false;
+    if (p < end && *p == '.'){
+        is_float = true;
+        for (p += 1; p < end && *p >= '0' && *p <= '9'; ++p, ++frac_digits){
+            if (digits < 19){
+                mantissa = mantissa*10 + (uint64_t) (*p - '0');
+                exponent -= 1;
+                if (mantissa != 0) digits += 1;
+            }
+            else{
+                truncated |= *p != '0';
+            }
+        }
+    }
+    if (int_digits + frac_digits == 0) return CLEKS_WORD;
+    if (p < end && (*p == 'e' || *p == 'E')){
+        is_float = true;
+        p += 1;
+        bool exp_negative = false;
+        if (p < end && (*p == '+' || *p == '-')){
+            exp_negative = *p == '-';
+            p += 1;
+        }
+        if (p == end) return CLEKS_WORD;
+        int64_t exp_value = 0;
+        for (; p < end && *p >= '0' && *p <= '9'; ++p){
+            if (exp_value < 100000) exp_value = exp_value*10 + (*p - '0');
+        }
+        exponent += exp_negative ? -exp_value : exp_value;
+    }
+    if (p != end) return CLEKS_WORD;
+
+    if (!is_float && (config_flags & CLEKS_FLAG_NO_INTEGERS) == 0){
+        uint64_t limit = negative ? (uint64_t) INT64_MAX + 1 : (uint64_t) INT64_MAX;
+        if (overflow || integer > limit){
+            token->flags |= CLEKS_TOKEN_FLAG_OVERFLOW;
+            integer = limit;
+        }
+        token->int_value = negative ? (int64_t) (0 - integer) : (int64_t) integer;
+        return CLEKS_INT;
+    }
+    if (config_flags & CLEKS_FLAG_NO_FLOATS) return CLEKS_WORD;
+    double value;
+    if (mantissa == 0 && !truncated){
+        value = 0.0;
+    }
+    else if (!truncated && mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22){
+        // the mantissa and the power of ten are exact doubles, so a single operation rounds correctly
+        value = (double) mantissa;
+        value = exponent < 0 ? value / cleks_pow10[-exponent] : value * cleks_pow10[exponent];
+    }
+    else{
+        value = fabs(cleks_parse_float_slow(s, n));
+    }
+    if (isinf(value)) token->flags |= CLEKS_TOKEN_FLAG_OVERFLOW;
+    token->float_value = negative ? -value : value;
+    return CLEKS_FLOAT;
+}
+
+/* Hashing */
+
+static uint64_t cleks_hash(const char *s, size_t n)
+{
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i=0; i<n; ++i){
+        hash ^= (uint8_t) s[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static uint64_t cleks_read64(const char *p)
+{
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    return word;
+}
+
+static uint64_t cleks_hash_round(uint64_t lane, uint64_t word)
+{
+    lane += word*0xC2B2AE3D27D4EB4FULL;
+    lane = (lane << 31) | (lane >> 33);
+    return lane*0x9E3779B185EBCA87ULL;
+}
+
+// a hash of whole inputs, which reads 32 bytes per round instead of single bytes (the rounds of xxHash64)
+static uint64_t cleks_hash_input(const char *s, size_t n)
+{
+    uint64_t lanes[4] = {0x60EA27EEADC0B5D6ULL, 0xC2B2AE3D27D4EB4FULL, 0ULL, 0x61C8864E7A143579ULL};
+    size_t i = 0;
+    for (; i+32 <= n; i += 32){
+        for (size_t lane=0; lane<4; ++lane) lanes[lane] = cleks_hash_round(lanes[lane], cleks_read64(s + i + lane*8));
+    }
+    uint64_t hash = (uint64_t) n;
+    for (size_t lane=0; lane<4; ++lane) hash = (hash ^ cleks_hash_round(0, lanes[lane]))*0x9E3779B185EBCA87ULL + 0x85EBCA77C2B2AE63ULL;
+    for (; i<n; ++i){
+        hash ^= (uint8_t) s[i]*0x27D4EB2F165667C5ULL;
+        hash = ((hash << 11) | (hash >> 53))*0x9E3779B185EBCA87ULL;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xC2B2AE3D27D4EB4FULL;
+    hash ^= hash >> 29;
+    return hash;
+}
+
+/* Scanning kernels */
+
+static const char* cleks_find2_scalar(const char *p, const char *end, char a, char b)
+{
+    for (; p < end; ++p){
+        if (*p == a || *p == b) return p;
+    }
+    return end;
+}
+
+static const char* cleks_skip_set_scalar(const char *p, const char *end, const char *set, size_t set_size)
+{
+    for (; p < end; ++p){
+        size_t i = 0;
+        while (i < set_size && *p != set[i]) ++i;
+        if (i == set_size) return p;
+    }
+    return end;
+}
+
+static const char* cleks_find_str_scalar(const char *p, const char *end, const char *needle, size_t n)
+{
+    while ((size_t) (end - p) >= n){
+        const char *found = (const char*) memchr(p, needle[0], (end - p) - n + 1);
+        if (found == NULL) break;
+        if (memcmp(found + 1, needle + 1, n - 1) == 0) return found;
+        p = found + 1;
+    }
+    return end;
+}
+
+static size_t cleks_find_all_scalar(const char *p, const char *end, char c, size_t base, size_t *out)
+{
+    size_t count = 0;
+    for (const char *start = p; p < end; ++p){
+        if (*p != c) continue;
+        if (out != NULL) out[count] = base + (p - start);
+        count += 1;
+    }
+    return count;
+}
+
+static const char* cleks_find2_ascii_scalar(const char *p, const char *end, char a, char b)
+{
+    for (; p < end; ++p){
+        if (*p == a || *p == b || (unsigned char) *p >= 0x80) return p;
+    }
+    return end;
+}
+
+#ifdef CLEKS_HAS_SSE2
+static const char* cleks_find2_ascii_sse2(const char *p, const char *end, char a, char b)
+{
+    // the sign bit of a byte marks it as non-ASCII
+    __m128i va = _mm_set1_epi8(a);
+    __m128i vb = _mm_set1_epi8(b);
+    for (; end - p >= 16; p += 16){
+        __m128i v = _mm_loadu_si128((const __m128i*) p);
+        int mask = _mm_movemask_epi8(_mm_or_si128(v, _mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb))));
+        if (mask != 0) return p + __builtin_ctz((unsigned) mask);
+    }
+    return cleks_find2_ascii_scalar(p, end, a, b);
+}
+
+static const char* cleks_find2_sse2(const char *p, const char *end, char a, char b)
+{
+    __m128i va = _mm_set1_epi8(a);
+    __m128i vb = _mm_set1_epi8(b);
+    for (; end - p >= 16; p += 16){
+        __m128i v = _mm_loadu_si128((const __m128i*) p);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+        if (mask != 0) return p + __builtin_ctz((unsigned) mask);
+    }
+    return cleks_find2_scalar(p, end, a, b);
+}
+
+static const char* cleks_skip_set_sse2(const char *p, const char *end, const char *set, size_t set_size)
+{
+    for (; end - p >= 16; p += 16){
+        __m128i v = _mm_loadu_si128((const __m128i*) p);
+        __m128i in_set = _mm_setzero_si128();
+        for (size_t i=0; i<set_size; ++i){
+            in_set = _mm_or_si128(in_set, _mm_cmpeq_epi8(v, _mm_set1_epi8(set[i])));
+        }
+        unsigned mask = ~(unsigned) _mm_movemask_epi8(in_set) & 0xFFFF;
+        if (mask != 0) return p + __builtin_ctz(mask);
+    }
+    return cleks_skip_set_scalar(p, end, set, set_size);
+}
+
+static const char* cleks_find_str_sse2(const char *p, const char *end, const char *needle, size_t n)
+{
+    // only positions matching both the first and the last byte of the needle are compared
+    __m128i first = _mm_set1_epi8(needle[0]);
+    __m128i last = _mm_set1_epi8(needle[n-1]);
+    for (; (size_t) (end - p) >= 16 + n - 1; p += 16){
+        __m128i v_first = _mm_loadu_si128((const __m128i*) p);
+        __m128i v_last = _mm_loadu_si128((const __m128i*) (p + n - 1));
+        unsigned mask = (unsigned) _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(v_first, first), _mm_cmpeq_epi8(v_last, last)));
+        while (mask != 0){
+            int i = __builtin_ctz(mask);
+            if (memcmp(p + i + 1, needle + 1, n - 2) == 0) return p + i;
+            mask &= mask - 1;
+        }
+    }
+    return cleks_find_str_scalar(p, end, needle, n);
+}
+
+static size_t cleks_find_all_sse2(const char *p, const char *end, char c, size_t base, size_t *out)
+{
+    const char *start = p;
+    __m128i vc = _mm_set1_epi8(c);
+    size_t count = 0;
+    for (; end - p >= 16; p += 16){
+        unsigned mask = (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) p), vc));
+        if (out == NULL){
+            count += __builtin_popcount(mask);
+            continue;
+        }
+        for (; mask != 0; mask &= mask - 1) out[count++] = base + (p - start) + __builtin_ctz(mask);
+    }
+    return count + cleks_find_all_scalar(p, end, c, base + (p - start), out != NULL ? out + count : NULL);
+}
+#endif // CLEKS_HAS_SSE2
+
+#ifdef CLEKS_HAS_AVX2
+__attribute__((target("avx2")))
+static const char* cleks_find2_avx2(const char *p, const char *end, char a, char b)
+{
+    __m256i va = _mm256_set1_epi8(a);
+    __m256i vb = _mm256_set1_epi8(b);
+    for (; end - p >= 32; p += 32){
+        __m256i v = _mm256_loadu_si256((const __m256i*) p);
+        unsigned mask = (unsigned) _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)));
+        if (mask != 0) return p + __builtin_ctz(mask);
+    }
+    return cleks_find2_scalar(p, end, a, b);
+}
+
+__attribute__((target("avx2")))
+static const char* cleks_find2_ascii_avx2(const char *p, const char *end, char a, char b)
+{
+    __m256i va = _mm256_set1_epi8(a);
+    __m256i vb = _mm256_set1_epi8(b);
+    for (; end - p >= 32; p += 32){
+        __m256i v = _mm256_loadu_si256((const __m256i*) p);
+        unsigned mask = (unsigned) _mm256_movemask_epi8(_mm256_or_si256(v, _mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb))));
+        if (mask != 0) return p + __builtin_ctz(mask);
+    }
+    return cleks_find2_ascii_scalar(p, end, a, b);
+}
+
+__attribute__((target("avx2")))
+static const char* cleks_skip_set_avx2(const char *p, const char *end, const char *set, size_t set_size)
+{
+    for (; end - p >= 32; p += 32){
+        __m256i v = _mm256_loadu_si256((const __m256i*) p);
+        __m256i in_set = _mm256_setzero_si256();
+        for (size_t i=0; i<set_size; ++i){
+            in_set = _mm256_or_si256(in_set, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(set[i])));
+        }
+        unsigned mask = ~(unsigned) _mm256_movemask_epi8(in_set);
+        if (mask != 0) return p + __builtin_ctz(mask);
+    }
+    return cleks_skip_set_scalar(p, end, set, set_size);
+}
+
+__attribute__((target("avx2")))
+static const char* cleks_find_str_avx2(const char *p, const char *end, const char *needle, size_t n)
+{
+    __m256i first = _mm256_set1_epi8(needle[0]);
+    __m256i last = _mm256_set1_epi8(needle[n-1]);
+    for (; (size_t) (end - p) >= 32 + n - 1; p += 32){
+        __m256i v_first = _mm256_loadu_si256((const __m256i*) p);
+        __m256i v_last = _mm256_loadu_si256((const __m256i*) (p + n - 1));
+        unsigned mask = (unsigned) _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(v_first, first), _mm256_cmpeq_epi8(v_last, last)));
+        while (mask != 0){
+            int i = __builtin_ctz(mask);
+            if (memcmp(p + i + 1, needle + 1, n - 2) == 0) return p + i;
+            mask &= mask - 1;
+        }
+    }
+    return cleks_find_str_scalar(p, end, needle, n);
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t cleks_find_all_avx2(const char *p, const char *end, char c, size_t base, size_t *out)
+{
+    const char *start = p;
+    __m256i vc = _mm256_set1_epi8(c);
+    size_t count = 0;
+    for (; end - p >= 32; p += 32){
+        unsigned mask = (unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) p), vc));
+        if (out == NULL){
+            count += __builtin_popcount(mask);
+            continue;
+        }
+        for (; mask != 0; mask &= mask - 1) out[count++] = base + (p - start) + __builtin_ctz(mask);
+    }
+    return count + cleks_find_all_scalar(p, end, c, base + (p - start), out != NULL ? out + count : NULL);
+}
+
+// the CPU model is detected by a constructor of the runtime before main, so threads only ever read it
+static inline bool cleks_has_avx2(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+#endif // CLEKS_HAS_AVX2
+
+// returns the first character in [p, end) that equals a or b, end if there is none
+static const char* cleks_find2(const char *p, const char *end, char a, char b)
+{
+#ifdef CLEKS_HAS_AVX2
+    if (end - p >= 32 && cleks_has_avx2()) return cleks_find2_avx2(p, end, a, b);
+#endif // CLEKS_HAS_AVX2
+#ifdef CLEKS_HAS_SSE2
+    return cleks_find2_sse2(p, end, a, b);
+#else
+    return cleks_find2_scalar(p, end, a, b);
+#endif // CLEKS_HAS_SSE2
+}
+
+// returns the first character in [p, end) that equals a or b or is not ASCII, end if there is none
+static const char* cleks_find2_ascii(const char *p, const char *end, char a, char b)
+{
+#ifdef CLEKS_HAS_AVX2
+    if (end - p >= 32 && cleks_has_avx2()) return cleks_find2_ascii_avx2(p, end, a, b);
+#endif // CLEKS_HAS_AVX2
+#ifdef CLEKS_HAS_SSE2
+    return cleks_find2_ascii_sse2(p, end, a, b);
+#else
+    return cleks_find2_ascii_scalar(p, end, a, b);
+#endif // CLEKS_HAS_SSE2
+}
+
+// returns the first character in [p, end) that is not in set, end if there is none
+static const char* cleks_skip_set(const char *p, const char *end, const char *set, size_t set_size)
+{
+#ifdef CLEKS_HAS_AVX2
+    if (end - p >= 32 && cleks_has_avx2()) return cleks_skip_set_avx2(p, end, set, set_size);
+#endif // CLEKS_HAS_AVX2
+#ifdef CLEKS_HAS_SSE2
+    return cleks_skip_set_sse2(p, end, set, set_size);
+#else
+    return cleks_skip_set_scalar(p, end, set, set_size);
+#endif // CLEKS_HAS_SSE2
+}
+
+// returns the first occurrence of the needle (n > 0) in [p, end), end if there is none
+static const char* cleks_find_str(const char *p, const char *end, const char *needle, size_t n)
+{
+    if (n == 1){
+        const char *found = (const char*) memchr(p, needle[0], end - p);
+        return found != NULL ? found : end;
+    }
+#ifdef CLEKS_HAS_AVX2
+    if ((size_t) (end - p) >= 32 + n - 1 && cleks_has_avx2()) return cleks_find_str_avx2(p, end, needle, n);
+#endif // CLEKS_HAS_AVX2
+#ifdef CLEKS_HAS_SSE2
+    return cleks_find_str_sse2(p, end, needle, n);
+#else
+    return cleks_find_str_scalar(p, end, needle, n);
+#endif // CLEKS_HAS_SSE2
 }
 
-static bool cleks_str_is_float(char* s)
+// writes base plus the offset of every c in [p, end) to out (if not NULL) and returns their number
+static size_t cleks_find_all(const char *p, const char *end, char c, size_t base, size_t *out)
 {
-    char* ep = NULL;
-    strtod(s, &ep);
-    return (ep && !*ep);
+#ifdef CLEKS_HAS_AVX2
+    if (end - p >= 32 && cleks_has_avx2()) return cleks_find_all_avx2(p, end, c, base, out);
+#endif // CLEKS_HAS_AVX2
+#ifdef CLEKS_HAS_SSE2
+    return cleks_find_all_sse2(p, end, c, base, out);
+#else
+    return cleks_find_all_scalar(p, end, c, base, out);
+#endif // CLEKS_HAS_SSE2
 }
 
 #endif // _CLEKS_H
\ No newline at end of file
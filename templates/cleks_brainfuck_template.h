@@ -14,10 +14,10 @@ enum BrainfuckTokens{
 };
 
 static CleksTokenConfig BrainfuckTokenConfig[] = {
-    [INCR_DP] = {"IncrDP", "", '>'},
-    [DECR_DP] = {"DecrDP", "", '<'},
-    [INCR_DATA] = {"IncrData", "", '+'},
-    [DECR_DATA] = {"DecrData", "", '-'},
+    [INCR_DP] = {"IncrDP", "", '>', NULL, true},
+    [DECR_DP] = {"DecrDP", "", '<', NULL, true},
+    [INCR_DATA] = {"IncrData", "", '+', NULL, true},
+    [DECR_DATA] = {"DecrData", "", '-', NULL, true},
     [DATA_OUT] = {"DataOut", "", '.'},
     [DATA_IN] = {"DataIn", "", ','},
     [JUMP_FWD] = {"JumpFwd", "", '['},
@@ -25,9 +25,9 @@ static CleksTokenConfig BrainfuckTokenConfig[] = {
 };
 
 /*
-    Brainfuck interprets every character that is not one of the commands as a comment. 
-    Cleks does not support this feature directly, yet every comment will be lexed as a 'TOKEN_WORD'.
-    When using the tokens, simply ignore these tokens and everything should behave as usual.
+    Brainfuck interprets every character that is not one of the commands as a comment,
+    therefore all other characters are skipped (CLEKS_FLAG_IGNORE_UNKNOWN).
+    Runs of '>', '<', '+' and '-' are lexed as a single token, its length being the repeat count.
 */
 
 CleksComment BrainfuckComments[] = {};
@@ -43,7 +43,7 @@ CleksConfig BrainfuckConfig = {
     .string_count = CLEKS_ARR_LEN(BrainfuckStrings),
     .comments = BrainfuckComments,
     .comment_count = CLEKS_ARR_LEN(BrainfuckComments),
-    .flags = CLEKS_FLAG_NO_INTEGERS | CLEKS_FLAG_NO_FLOATS
+    .flags = CLEKS_FLAG_NO_INTEGERS | CLEKS_FLAG_NO_FLOATS | CLEKS_FLAG_IGNORE_UNKNOWN
 };
 
 #endif // _CLEKS_BRAINFUCK_TEMPLATE
\ No newline at end of file
@@ -41,7 +41,224 @@ CleksConfig JsonConfig = {
     .string_count = CLEKS_ARR_LEN(JsonStrings),
     .comments = JsonComments,
     .comment_count = CLEKS_ARR_LEN(JsonComments),
-    .flags = CLEKS_FLAG_DEFAULT
+    .flags = CLEKS_FLAG_VALIDATE_UTF8 | CLEKS_FLAG_JSON_ESCAPES
 };
 
+/* Tape */
+
+// The tape holds one entry per JSON value of the tokens, in document order.
+// The children of a container follow its entry and end at its next entry,
+// the children of an object alternate between keys and values.
+// Entry 0 is the root value.
+
+#define CLEKS_JSON_NONE ((size_t) -1) // returned by lookups that did not find a value
+
+typedef struct{
+    uint32_t token;  // the index of the value's first token
+    uint32_t next;   // the index of the entry after the value and all of its children
+} CleksJsonEntry;
+
+typedef struct{
+    CleksTokens *tokens;      // the tokens the tape was built from, not owned by the tape
+    CleksJsonEntry *entries;  // the values of the tokens
+    size_t size;              // the number of entries
+    CleksAllocator allocator; // the allocator of the entries, the one of the tokens
+} CleksJsonTape;
+
+CleksJsonTape* Cleks_json_tape(CleksTokens *tokens, CleksError *error);
+void Cleks_json_free_tape(CleksJsonTape *tape);
+CleksToken* Cleks_json_token(CleksJsonTape *tape, size_t entry);
+size_t Cleks_json_skip(CleksJsonTape *tape, size_t entry);
+size_t Cleks_json_length(CleksJsonTape *tape, size_t entry);
+size_t Cleks_json_key(CleksJsonTape *tape, size_t object, const char *key);
+size_t Cleks_json_index(CleksJsonTape *tape, size_t array, size_t index);
+
+typedef enum{
+    CLEKS_JSON_EXPECT_VALUE,        // a value
+    CLEKS_JSON_EXPECT_FIRST_VALUE,  // a value or the close of an empty array
+    CLEKS_JSON_EXPECT_KEY,          // a string key
+    CLEKS_JSON_EXPECT_FIRST_KEY,    // a string key or the close of an empty object
+    CLEKS_JSON_EXPECT_MAP_SEP,      // the ':' after a key
+    CLEKS_JSON_EXPECT_NEXT,         // a ',' or the close of the innermost container
+    CLEKS_JSON_EXPECT_END           // nothing, the root value is complete
+} CleksJsonExpect;
+
+static void cleks_json_error(CleksJsonTape *tape, CleksError *error, CleksErrorCode code, size_t offset)
+{
+    if (error == NULL) return;
+    size_t line = 1, line_start = 0;
+    if (tape->tokens->buffer != NULL) cleks_count_lines(tape->tokens->buffer, offset, 0, &line, &line_start);
+    error->code = code;
+    error->offset = offset;
+    error->line = line;
+    error->column = offset - line_start + 1;
+    error->count = 1;
+}
+
+CleksJsonTape* Cleks_json_tape(CleksTokens *tokens, CleksError *error)
+{
+    cleks_assert(tokens != NULL, "Invalid arguments: tokens=%p", tokens);
+    if (error != NULL) memset(error, 0, sizeof(*error));
+    CleksJsonTape *tape = (CleksJsonTape*) Cleks_alloc(&tokens->allocator, sizeof(CleksJsonTape));
+    if (tape == NULL){
+        if (error != NULL) error->code = CLEKS_ERROR_ALLOCATION;
+        return NULL;
+    }
+    memset(tape, 0, sizeof(*tape));
+    tape->tokens = tokens;
+    tape->allocator = tokens->allocator;
+    // every value starts with a token and containers are nested at most once per token
+    size_t *open = NULL;
+    if (tokens->size >= UINT32_MAX) goto allocation_error;
+    tape->entries = (CleksJsonEntry*) Cleks_alloc(&tape->allocator, (tokens->size+1)*sizeof(CleksJsonEntry));
+    open = (size_t*) Cleks_alloc(&tape->allocator, (tokens->size+1)*sizeof(size_t));
+    if (tape->entries == NULL || open == NULL) goto allocation_error;
+    size_t depth = 0;
+    CleksJsonExpect expect = CLEKS_JSON_EXPECT_VALUE;
+    for (size_t i=0; i<tokens->size; ++i){
+        CleksToken *token = &tokens->items[i];
+        switch (expect){
+            case CLEKS_JSON_EXPECT_MAP_SEP: {
+                if (token->type != JSON_MAP_SEP) goto unexpected_token;
+                expect = CLEKS_JSON_EXPECT_VALUE;
+            } break;
+            case CLEKS_JSON_EXPECT_FIRST_KEY:
+            case CLEKS_JSON_EXPECT_KEY: {
+                if (expect == CLEKS_JSON_EXPECT_FIRST_KEY && token->type == JSON_MAP_CLOSE) goto close;
+                if (token->type != CLEKS_STRING) goto unexpected_token;
+                tape->entries[tape->size] = (CleksJsonEntry) {(uint32_t) i, (uint32_t) tape->size+1};
+                tape->size += 1;
+                expect = CLEKS_JSON_EXPECT_MAP_SEP;
+            } break;
+            case CLEKS_JSON_EXPECT_FIRST_VALUE:
+            case CLEKS_JSON_EXPECT_VALUE: {
+                if (expect == CLEKS_JSON_EXPECT_FIRST_VALUE && token->type == JSON_ARRAY_CLOSE) goto close;
+                tape->entries[tape->size] = (CleksJsonEntry) {(uint32_t) i, (uint32_t) tape->size+1};
+                switch (token->type){
+                    case JSON_MAP_OPEN: expect = CLEKS_JSON_EXPECT_FIRST_KEY; open[depth++] = tape->size; break;
+                    case JSON_ARRAY_OPEN: expect = CLEKS_JSON_EXPECT_FIRST_VALUE; open[depth++] = tape->size; break;
+                    case CLEKS_STRING:
+                    case CLEKS_INT:
+                    case CLEKS_FLOAT:
+                    case JSON_TRUE:
+                    case JSON_FALSE:
+                    case JSON_NULL: expect = depth > 0 ? CLEKS_JSON_EXPECT_NEXT : CLEKS_JSON_EXPECT_END; break;
+                    default: goto unexpected_token;
+                }
+                tape->size += 1;
+            } break;
+            case CLEKS_JSON_EXPECT_NEXT: {
+                bool in_object = tokens->items[tape->entries[open[depth-1]].token].type == JSON_MAP_OPEN;
+                if (token->type == JSON_ITER_SEP){
+                    expect = in_object ? CLEKS_JSON_EXPECT_KEY : CLEKS_JSON_EXPECT_VALUE;
+                    break;
+                }
+                if (token->type != (in_object ? JSON_MAP_CLOSE : JSON_ARRAY_CLOSE)) goto unexpected_token;
+                goto close;
+            } break;
+            case CLEKS_JSON_EXPECT_END: goto unexpected_token;
+        }
+        continue;
+    close:
+        // the container ends after its last child
+        depth -= 1;
+        tape->entries[open[depth]].next = (uint32_t) tape->size;
+        expect = depth > 0 ? CLEKS_JSON_EXPECT_NEXT : CLEKS_JSON_EXPECT_END;
+        continue;
+    unexpected_token:
+        cleks_json_error(tape, error, CLEKS_ERROR_UNEXPECTED_TOKEN, cleks_token_start(token));
+        goto fail;
+    }
+    if (expect != CLEKS_JSON_EXPECT_END){
+        cleks_json_error(tape, error, CLEKS_ERROR_UNEXPECTED_END, tokens->buffer_size);
+        goto fail;
+    }
+    Cleks_free(&tape->allocator, open);
+    return tape;
+allocation_error:
+    if (error != NULL){
+        error->code = CLEKS_ERROR_ALLOCATION;
+        error->count = 1;
+    }
+fail:
+    Cleks_free(&tape->allocator, open);
+    Cleks_json_free_tape(tape);
+    return NULL;
+}
+
+void Cleks_json_free_tape(CleksJsonTape *tape)
+{
+    if (tape == NULL) return;
+    CleksAllocator allocator = tape->allocator;
+    Cleks_free(&allocator, tape->entries);
+    Cleks_free(&allocator, tape);
+}
+
+CleksToken* Cleks_json_token(CleksJsonTape *tape, size_t entry)
+{
+    if (tape == NULL || entry >= tape->size) return NULL;
+    return &tape->tokens->items[tape->entries[entry].token];
+}
+
+size_t Cleks_json_skip(CleksJsonTape *tape, size_t entry)
+{
+    cleks_assert(tape != NULL && entry < tape->size, "Invalid entry: %zu", entry);
+    return tape->entries[entry].next;
+}
+
+// returns the number of elements of an array or of pairs of an object, 0 for other values
+size_t Cleks_json_length(CleksJsonTape *tape, size_t entry)
+{
+    cleks_assert(tape != NULL && entry < tape->size, "Invalid entry: %zu", entry);
+    size_t length = 0;
+    for (size_t child = entry+1; child < tape->entries[entry].next; child = tape->entries[child].next) length += 1;
+    return Cleks_json_token(tape, entry)->type == JSON_MAP_OPEN ? length/2 : length;
+}
+
+static bool cleks_json_key_equals(CleksTokens *tokens, CleksToken *token, const char *key, size_t key_length)
+{
+    if (token->value != NULL) return strncmp(token->value, key, key_length) == 0 && token->value[key_length] == '\0';
+    // an escape sequence is longer than the character it stands for
+    if (token->length < key_length) return false;
+    if ((token->flags & CLEKS_TOKEN_FLAG_ESCAPES) == 0){
+        return token->length == key_length && memcmp(tokens->buffer + token->offset, key, key_length) == 0;
+    }
+    // the escaped key is decoded one character or escape sequence at a time and compared as it goes
+    const char *text = tokens->buffer + token->offset;
+    bool unicode = token->flags & CLEKS_TOKEN_FLAG_UNICODE;
+    size_t i = 0, matched = 0;
+    while (i < token->length){
+        char decoded[4];
+        size_t length = cleks_unescape_next(text, token->length, &i, unicode, decoded);
+        if (length > key_length - matched || memcmp(decoded, key + matched, length) != 0) return false;
+        matched += length;
+    }
+    return matched == key_length;
+}
+
+// returns the entry of the value of key in object, CLEKS_JSON_NONE if there is none
+size_t Cleks_json_key(CleksJsonTape *tape, size_t object, const char *key)
+{
+    cleks_assert(tape != NULL && key != NULL, "Invalid arguments: tape=%p, key=%p", tape, key);
+    CleksToken *token = Cleks_json_token(tape, object);
+    if (token == NULL || token->type != JSON_MAP_OPEN) return CLEKS_JSON_NONE;
+    size_t key_length = strlen(key);
+    // the values are skipped without visiting their children
+    for (size_t child = object+1; child < tape->entries[object].next; child = tape->entries[child+1].next){
+        if (cleks_json_key_equals(tape->tokens, Cleks_json_token(tape, child), key, key_length)) return child+1;
+    }
+    return CLEKS_JSON_NONE;
+}
+
+// returns the entry of the element at index of array, CLEKS_JSON_NONE if there is none
+size_t Cleks_json_index(CleksJsonTape *tape, size_t array, size_t index)
+{
+    cleks_assert(tape != NULL, "Invalid tape: %p", tape);
+    CleksToken *token = Cleks_json_token(tape, array);
+    if (token == NULL || token->type != JSON_ARRAY_OPEN) return CLEKS_JSON_NONE;
+    size_t child = array+1;
+    for (; child < tape->entries[array].next && index > 0; child = tape->entries[child].next) index -= 1;
+    return child < tape->entries[array].next ? child : CLEKS_JSON_NONE;
+}
+
 #endif // _CLEKS_JSON_TEMPLATE_H
\ No newline at end of file
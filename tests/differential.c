@@ -0,0 +1,431 @@
+/*
+    Differential tests of the lexing entry points against Cleks_lex_checked on random inputs.
+
+    Build and run from the repository root:
+        cc -O1 -g -fsanitize=address,undefined -o tests/differential tests/differential.c -lm -lpthread
+        ./tests/differential [<runs>] [<seed>]
+
+    Every random input is made of pieces that matter to the config (delimiters, escapes, UTF-8 sequences, ...)
+    and lexed with Cleks_lex_parallel, Cleks_next_token, Cleks_relex, Cleks_tokens_load and Cleks_lex_batch,
+    which have to return the same tokens and errors as Cleks_lex_checked.
+    The program prints the first mismatches and returns 1 if there were any.
+*/
+// split even the smallest inputs between threads
+#define CLEKS_PARALLEL_MIN_CHUNK 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../cleks.h"
+#include "../templates/cleks_json_template.h"
+
+#define TEST_MAX_PIECES 24
+#define TEST_MAX_LENGTH 512
+#define TEST_MAX_REPORTS 10
+#define TEST_BATCH_SIZE 8
+
+/* Configs */
+
+CleksConfig JsonSpansConfig = {
+    .default_tokens = CleksDefaultTokenConfig,
+    .default_token_count = CLEKS_TOKEN_COUNT,
+    .custom_tokens = JsonTokenConfig,
+    .custom_token_count = CLEKS_ARR_LEN(JsonTokenConfig),
+    .whitespaces = " \n",
+    .strings = JsonStrings,
+    .string_count = CLEKS_ARR_LEN(JsonStrings),
+    .comments = JsonComments,
+    .comment_count = CLEKS_ARR_LEN(JsonComments),
+    .flags = CLEKS_FLAG_SPANS | CLEKS_FLAG_VALIDATE_UTF8 | CLEKS_FLAG_JSON_ESCAPES
+};
+
+CleksTokenConfig DslTokenConfig[] = {
+    {.print_string="Lt", .word="", .symbol='<'},
+    {.print_string="If", .word="if", .symbol='\0'},
+    {.print_string="LB", .word="", .symbol='('},
+    {.print_string="RB", .word="", .symbol=')'},
+    {.print_string="Then", .word="then", .symbol='\0'},
+    {.print_string="Le", .word="", .symbol='\0', .long_symbol="<="},
+    {.print_string="Same", .word="", .symbol='\0', .long_symbol="==="},
+    {.print_string="Arrow", .word="", .symbol='\0', .long_symbol="=>"},
+    {.print_string="Plus", .word="", .symbol='+', .coalesce=true}
+};
+
+CleksComment DslComments[] = {
+    {"//", "\n"},
+    {"#", "\n"},
+    {"/*", "*/"}
+};
+
+CleksString DslStrings[] = {
+    {'"', '"'},
+    {'[', ']'}
+};
+
+CleksConfig DslConfig = {
+    .default_tokens = CleksDefaultTokenConfig,
+    .default_token_count = CLEKS_TOKEN_COUNT,
+    .custom_tokens = DslTokenConfig,
+    .custom_token_count = CLEKS_ARR_LEN(DslTokenConfig),
+    .whitespaces = " \n\t",
+    .strings = DslStrings,
+    .string_count = CLEKS_ARR_LEN(DslStrings),
+    .comments = DslComments,
+    .comment_count = CLEKS_ARR_LEN(DslComments),
+    .flags = CLEKS_FLAG_DEFAULT
+};
+
+CleksConfig DslUtf8Config = {
+    .default_tokens = CleksDefaultTokenConfig,
+    .default_token_count = CLEKS_TOKEN_COUNT,
+    .custom_tokens = DslTokenConfig,
+    .custom_token_count = CLEKS_ARR_LEN(DslTokenConfig),
+    .whitespaces = " \n\t",
+    .strings = DslStrings,
+    .string_count = CLEKS_ARR_LEN(DslStrings),
+    .comments = DslComments,
+    .comment_count = CLEKS_ARR_LEN(DslComments),
+    .flags = CLEKS_FLAG_SPANS | CLEKS_FLAG_VALIDATE_UTF8
+};
+
+static const char *json_pieces[] = {
+    "{", "}", "[", "]", ":", ",", "\"", "\"", "\"key\"", " ", "\n", "1", "-2.5e3", "true", "null", "x",
+    "\\", "\\n", "\\\"", "\\u00e9", "\\ud83d", "\\ude00", "\\u12", "\\q",
+    "\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x98\x80", "\xc3", "\xed\xa0\x80", "\xff"
+};
+
+static const char *dsl_pieces[] = {
+    "<", "<=", "===", "=>", "=", "(", ")", "+", "++", "if", "then", "a", "12", "3.5", " ", "\n", "\t",
+    "\"", "[", "]", "\\", "//", "#", "/*", "*/", "\xc3\xa9", "\xc3", "\xff"
+};
+
+typedef struct{
+    const char *name;
+    CleksConfig *config;
+    const char **pieces;
+    size_t piece_count;
+} TestConfig;
+
+static TestConfig test_configs[] = {
+    {"json", &JsonConfig, json_pieces, CLEKS_ARR_LEN(json_pieces)},
+    {"json spans", &JsonSpansConfig, json_pieces, CLEKS_ARR_LEN(json_pieces)},
+    {"dsl", &DslConfig, dsl_pieces, CLEKS_ARR_LEN(dsl_pieces)},
+    {"dsl utf-8 spans", &DslUtf8Config, dsl_pieces, CLEKS_ARR_LEN(dsl_pieces)}
+};
+
+static const CleksErrorPolicy test_policies[] = {CLEKS_ON_ERROR_FREE, CLEKS_ON_ERROR_PARTIAL, CLEKS_ON_ERROR_RECOVER};
+static const char *test_policy_names[] = {"free", "partial", "recover"};
+
+/* Helpers */
+
+static uint64_t test_state = 0x853c49e6748fea9bULL;
+
+static uint64_t test_random(void)
+{
+    // xorshift64
+    test_state ^= test_state << 13;
+    test_state ^= test_state >> 7;
+    test_state ^= test_state << 17;
+    return test_state;
+}
+
+static size_t random_input(TestConfig *test, char *buffer)
+{
+    size_t size = 0;
+    size_t pieces = test_random() % (TEST_MAX_PIECES+1);
+    for (size_t i=0; i<pieces; ++i){
+        const char *piece = test->pieces[test_random() % test->piece_count];
+        size_t length = strlen(piece);
+        if (size + length > TEST_MAX_LENGTH) break;
+        memcpy(buffer + size, piece, length);
+        size += length;
+    }
+    return size;
+}
+
+static bool same_token(CleksToken *a, CleksToken *b)
+{
+    if (a->type != b->type || a->offset != b->offset || a->length != b->length || a->flags != b->flags) return false;
+    if ((a->value == NULL) != (b->value == NULL)) return false;
+    if (a->value != NULL && strcmp(a->value, b->value) != 0) return false;
+    if (a->type == CLEKS_INT && a->int_value != b->int_value) return false;
+    if (a->type == CLEKS_FLOAT && memcmp(&a->float_value, &b->float_value, sizeof(double)) != 0) return false;
+    return true;
+}
+
+static bool same_tokens(CleksTokens *expected, CleksTokens *actual)
+{
+    if ((expected == NULL) != (actual == NULL)) return false;
+    if (expected == NULL) return true;
+    if (expected->size != actual->size || expected->clean_size != actual->clean_size) return false;
+    if (expected->error_code != actual->error_code || expected->error_count != actual->error_count || expected->error_end != actual->error_end) return false;
+    for (size_t i=0; i<expected->size; ++i){
+        if (!same_token(&expected->items[i], &actual->items[i])) return false;
+    }
+    return true;
+}
+
+static bool within_buffer(CleksTokens *tokens)
+{
+    for (size_t i=0; i<tokens->size; ++i){
+        CleksToken *token = &tokens->items[i];
+        size_t delimiters = token->type == CLEKS_STRING ? 1 : 0;
+        if (token->offset < delimiters || token->offset > tokens->buffer_size) return false;
+        if (tokens->buffer_size - token->offset < delimiters || token->length > tokens->buffer_size - token->offset - delimiters) return false;
+    }
+    return true;
+}
+
+static bool same_error(CleksError *expected, CleksError *actual)
+{
+    return memcmp(expected, actual, sizeof(CleksError)) == 0;
+}
+
+static size_t failures = 0;
+
+static void report(TestConfig *test, const char *check, const char *buffer, size_t size, const char *detail)
+{
+    failures += 1;
+    if (failures > TEST_MAX_REPORTS) return;
+    printf("MISMATCH %s: %s (%s) on \"", test->name, check, detail);
+    for (size_t i=0; i<size; ++i){
+        unsigned char c = (unsigned char) buffer[i];
+        if (c >= 0x20 && c < 0x7f && c != '\\' && c != '"') putchar(c);
+        else printf("\\x%02x", c);
+    }
+    printf("\"\n");
+}
+
+/* Checks */
+
+typedef struct{
+    int saved;
+    FILE *file;
+} TestCapture;
+
+static void begin_capture(TestCapture *capture)
+{
+    // the errors printed for invalid inputs are expected and compared between entry points
+    capture->saved = -1;
+    capture->file = NULL;
+#ifdef CLEKS_HAS_UNISTD
+    fflush(stderr);
+    capture->file = tmpfile();
+    if (capture->file == NULL) return;
+    capture->saved = dup(2);
+    dup2(fileno(capture->file), 2);
+#endif // CLEKS_HAS_UNISTD
+}
+
+static void end_capture(TestCapture *capture, char *message, size_t size)
+{
+    message[0] = '\0';
+#ifdef CLEKS_HAS_UNISTD
+    if (capture->file == NULL) return;
+    fflush(stderr);
+    dup2(capture->saved, 2);
+    close(capture->saved);
+    rewind(capture->file);
+    size_t n = fread(message, 1, size-1, capture->file);
+    message[n] = '\0';
+    fclose(capture->file);
+    // the location of cleks_error differs between entry points
+    char *text = strstr(message, "[ERROR]");
+    if (text != NULL) memmove(message, text, strlen(text)+1);
+#else
+    (void) capture;
+    (void) size;
+#endif // CLEKS_HAS_UNISTD
+}
+
+static void check_parallel(TestConfig *test, CleksCompiledConfig *compiled, char *buffer, size_t size)
+{
+    TestCapture capture;
+    char expected_message[256], actual_message[256];
+    begin_capture(&capture);
+    CleksTokens *expected = Cleks_lex_compiled(buffer, size, compiled);
+    end_capture(&capture, expected_message, sizeof(expected_message));
+    for (size_t nthreads=2; nthreads<=5; ++nthreads){
+        begin_capture(&capture);
+        CleksTokens *actual = Cleks_lex_parallel(buffer, size, compiled, nthreads);
+        end_capture(&capture, actual_message, sizeof(actual_message));
+        bool same = same_tokens(expected, actual) && strcmp(expected_message, actual_message) == 0;
+        Cleks_free_tokens(actual);
+        if (!same){
+            char detail[64];
+            snprintf(detail, sizeof(detail), "%zu threads", nthreads);
+            report(test, "Cleks_lex_parallel", buffer, size, detail);
+            break;
+        }
+    }
+    Cleks_free_tokens(expected);
+}
+
+typedef struct{
+    const char *buffer;
+    size_t size;
+    size_t position;
+    size_t chunk;
+} TestSource;
+
+static size_t read_source(void *user, char *buffer, size_t size)
+{
+    TestSource *source = (TestSource*) user;
+    size_t n = source->size - source->position;
+    if (n > source->chunk) n = source->chunk;
+    if (n > size) n = size;
+    memcpy(buffer, source->buffer + source->position, n);
+    source->position += n;
+    return n;
+}
+
+static void check_stream(TestConfig *test, CleksCompiledConfig *compiled, char *buffer, size_t size)
+{
+    CleksError expected_error;
+    CleksTokens *expected = Cleks_lex_checked(buffer, size, compiled, CLEKS_ON_ERROR_PARTIAL, &expected_error);
+    if (expected == NULL) return;
+    // streams stop at the first error like CLEKS_ON_ERROR_PARTIAL, the chunk boundaries fall everywhere
+    for (size_t chunk=1; chunk<=9; chunk+=4){
+        TestSource source = {.buffer=buffer, .size=size, .position=0, .chunk=chunk};
+        CleksStream *stream = Cleks_create_stream(compiled, read_source, &source, chunk);
+        if (stream == NULL) continue;
+        CleksToken token;
+        size_t count = 0;
+        bool same = true;
+        while (Cleks_next_token(stream, &token)){
+            same = same && count < expected->size && same_token(&expected->items[count], &token);
+            count += 1;
+            Cleks_free(NULL, token.value);
+        }
+        same = same && count == expected->size && same_error(&expected_error, &stream->error);
+        Cleks_free_stream(stream);
+        if (!same){
+            char detail[64];
+            snprintf(detail, sizeof(detail), "chunks of %zu bytes", chunk);
+            report(test, "Cleks_next_token", buffer, size, detail);
+            break;
+        }
+    }
+    Cleks_free_tokens(expected);
+}
+
+static void check_relex(TestConfig *test, CleksCompiledConfig *compiled, char *buffer, size_t size)
+{
+    // the edit replaces a random range of the input by random pieces
+    char inserted[TEST_MAX_LENGTH], edited[2*TEST_MAX_LENGTH];
+    size_t edit_offset = test_random() % (size+1);
+    size_t removed_length = test_random() % (size - edit_offset + 1);
+    size_t inserted_length = random_input(test, inserted) % 16;
+    memcpy(edited, buffer, edit_offset);
+    memcpy(edited + edit_offset, inserted, inserted_length);
+    memcpy(edited + edit_offset + inserted_length, buffer + edit_offset + removed_length, size - edit_offset - removed_length);
+    size_t edited_size = size - removed_length + inserted_length;
+    for (size_t i=0; i<CLEKS_ARR_LEN(test_policies); ++i){
+        CleksErrorPolicy policy = test_policies[i];
+        CleksTokens *actual = Cleks_lex_checked(buffer, size, compiled, policy, NULL);
+        if (actual == NULL) continue;
+        CleksError expected_error, actual_error;
+        CleksTokens *expected = Cleks_lex_checked(edited, edited_size, compiled, policy, &expected_error);
+        // an edit removing bytes past the end of the input is rejected without changing the tokens
+        bool rejected = !Cleks_relex(actual, compiled, edit_offset, size - edit_offset + 1, edited, edited_size, policy, &actual_error);
+        rejected = rejected && actual_error.code == CLEKS_ERROR_INVALID_EDIT && actual->buffer == buffer && actual->buffer_size == size;
+        bool completed = Cleks_relex(actual, compiled, edit_offset, removed_length, edited, edited_size, policy, &actual_error);
+        // the tokens are left unchanged when relexing fails with CLEKS_ON_ERROR_FREE
+        bool same = rejected && same_error(&expected_error, &actual_error) && completed == (expected_error.code == CLEKS_OK || policy == CLEKS_ON_ERROR_RECOVER);
+        if (expected != NULL || policy != CLEKS_ON_ERROR_FREE) same = same && same_tokens(expected, actual);
+        Cleks_free_tokens(expected);
+        Cleks_free_tokens(actual);
+        if (!same){
+            char detail[96];
+            snprintf(detail, sizeof(detail), "%s, %zu bytes at %zu replaced by %zu", test_policy_names[i], removed_length, edit_offset, inserted_length);
+            report(test, "Cleks_relex", buffer, size, detail);
+            break;
+        }
+    }
+}
+
+static void check_load(TestConfig *test, CleksCompiledConfig *compiled, char *buffer, size_t size)
+{
+    // CLEKS_ON_ERROR_FREE returns the tokens of CLEKS_ON_ERROR_PARTIAL or none
+    for (size_t i=1; i<CLEKS_ARR_LEN(test_policies); ++i){
+        CleksTokens *expected = Cleks_lex_checked(buffer, size, compiled, test_policies[i], NULL);
+        FILE *file = tmpfile();
+        if (expected == NULL || file == NULL){
+            Cleks_free_tokens(expected);
+            if (file != NULL) fclose(file);
+            continue;
+        }
+        // the serialized tokens are read back into memory like from a cache file
+        bool same = Cleks_tokens_serialize(expected, file);
+        long data_size = ftell(file);
+        char *data = (char*) malloc(data_size > 0 ? (size_t) data_size : 1);
+        rewind(file);
+        same = same && data != NULL && fread(data, 1, (size_t) data_size, file) == (size_t) data_size;
+        CleksTokens *actual = same ? Cleks_tokens_load(data, (size_t) data_size, buffer, size, *test->config) : NULL;
+        same = same && actual != NULL && same_tokens(expected, actual);
+        Cleks_free_tokens(actual);
+        if (same && (size_t) data_size > CLEKS_TOKENS_HEADER_SIZE){
+            // a corrupted token is rejected or still lies within the buffer
+            data[CLEKS_TOKENS_HEADER_SIZE + test_random() % ((size_t) data_size - CLEKS_TOKENS_HEADER_SIZE)] ^= (char) (1 << test_random() % 8);
+            actual = Cleks_tokens_load(data, (size_t) data_size, buffer, size, *test->config);
+            same = actual == NULL || within_buffer(actual);
+            Cleks_free_tokens(actual);
+        }
+        Cleks_free_tokens(expected);
+        free(data);
+        fclose(file);
+        if (!same){
+            report(test, "Cleks_tokens_load", buffer, size, test_policy_names[i]);
+            break;
+        }
+    }
+}
+
+static void check_batch(TestConfig *test, CleksCompiledConfig *compiled)
+{
+    // the batch is made of its own random inputs, lexed by fewer threads than there are inputs
+    static char inputs[TEST_BATCH_SIZE][TEST_MAX_LENGTH];
+    char *buffers[TEST_BATCH_SIZE];
+    size_t sizes[TEST_BATCH_SIZE];
+    for (size_t i=0; i<TEST_BATCH_SIZE; ++i){
+        buffers[i] = inputs[i];
+        sizes[i] = random_input(test, inputs[i]);
+    }
+    for (size_t i=0; i<CLEKS_ARR_LEN(test_policies); ++i){
+        CleksBatch *batch = Cleks_lex_batch(buffers, sizes, TEST_BATCH_SIZE, compiled, 3, test_policies[i]);
+        if (batch == NULL) continue;
+        for (size_t k=0; k<TEST_BATCH_SIZE; ++k){
+            CleksError expected_error;
+            CleksTokens *expected = Cleks_lex_checked(buffers[k], sizes[k], compiled, test_policies[i], &expected_error);
+            bool same = same_tokens(expected, Cleks_batch_tokens(batch, k)) && same_error(&expected_error, &batch->errors[k]);
+            Cleks_free_tokens(expected);
+            if (!same){
+                report(test, "Cleks_lex_batch", buffers[k], sizes[k], test_policy_names[i]);
+                break;
+            }
+        }
+        Cleks_free_batch(batch);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    size_t runs = argc > 1 ? (size_t) strtoull(argv[1], NULL, 10) : 20000;
+    if (argc > 2) test_state = strtoull(argv[2], NULL, 10) | 1;
+    char buffer[TEST_MAX_LENGTH];
+    for (size_t i=0; i<CLEKS_ARR_LEN(test_configs); ++i){
+        TestConfig *test = &test_configs[i];
+        CleksCompiledConfig *compiled = Cleks_compile_config(*test->config);
+        if (compiled == NULL) return 1;
+        for (size_t run=0; run<runs; ++run){
+            size_t size = random_input(test, buffer);
+            check_parallel(test, compiled, buffer, size);
+            check_stream(test, compiled, buffer, size);
+            check_relex(test, compiled, buffer, size);
+            check_load(test, compiled, buffer, size);
+            if (run % TEST_BATCH_SIZE == 0) check_batch(test, compiled);
+        }
+        Cleks_free_compiled_config(compiled);
+    }
+    printf("%zu random inputs per config: %zu mismatches\n", runs, failures);
+    return failures == 0 ? 0 : 1;
+}
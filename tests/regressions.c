@@ -0,0 +1,161 @@
+/*
+    Fixed inputs for bugs the differential tests cannot see, as every entry point agrees on them.
+
+    Build and run from the repository root:
+        cc -O1 -g -fsanitize=address,undefined -o tests/regressions tests/regressions.c -lm -lpthread
+        ./tests/regressions
+
+    The program prints every failing case and returns 1 if there were any.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <locale.h>
+#include "../cleks.h"
+#include "../templates/cleks_json_template.h"
+
+static size_t failures = 0;
+
+static void expect(bool condition, const char *name)
+{
+    if (condition) return;
+    failures += 1;
+    printf("FAILED %s\n", name);
+}
+
+/* Cases */
+
+static void test_load_corrupted_length(void)
+{
+    // spans are loaded without copying values, which would fail for a huge length
+    CleksConfig config;
+    memcpy(&config, &JsonConfig, sizeof(config));
+    config.flags |= CLEKS_FLAG_SPANS;
+    char buffer[] = "\"ab\"";
+    size_t size = strlen(buffer);
+    CleksTokens *tokens = Cleks_lex(buffer, size, config);
+    FILE *file = tmpfile();
+    if (tokens == NULL || file == NULL || !Cleks_tokens_serialize(tokens, file)){
+        expect(false, "load corrupted length: serialize");
+        return;
+    }
+    uint8_t data[CLEKS_TOKENS_HEADER_SIZE + 16];
+    rewind(file);
+    size_t data_size = fread(data, 1, sizeof(data), file);
+    fclose(file);
+    Cleks_free_tokens(tokens);
+    // the only token is a string of length 2^64-2, whose end wraps around to its start
+    size_t p = CLEKS_TOKENS_HEADER_SIZE + 2;
+    expect(data_size == p + 1 && data[p] == 2, "load corrupted length: layout");
+    for (size_t i=0; i<9; ++i) data[p++] = i == 0 ? 0xFE : 0xFF;
+    data[p++] = 0x01;
+    tokens = Cleks_tokens_load(data, p, buffer, size, config);
+    expect(tokens == NULL, "load corrupted length: rejected");
+    Cleks_free_tokens(tokens);
+}
+
+static void test_escaped_utf8(void)
+{
+    // without CLEKS_FLAG_JSON_ESCAPES, a backslash may escape a multi-byte character
+    CleksTokenConfig token_config[] = {{.print_string="Comma", .word="", .symbol=','}};
+    CleksString strings[] = {{'"', '"'}};
+    CleksConfig config = {
+        .default_tokens = CleksDefaultTokenConfig,
+        .default_token_count = CLEKS_TOKEN_COUNT,
+        .custom_tokens = token_config,
+        .custom_token_count = CLEKS_ARR_LEN(token_config),
+        .whitespaces = " \n",
+        .strings = strings,
+        .string_count = CLEKS_ARR_LEN(strings),
+        .flags = CLEKS_FLAG_VALIDATE_UTF8
+    };
+    CleksCompiledConfig *compiled = Cleks_compile_config(config);
+    char valid[] = "\"\\\xc3\xa9\", \"a\\\xf0\x9f\x98\x80" "b\"";
+    CleksError error;
+    CleksTokens *tokens = Cleks_lex_checked(valid, strlen(valid), compiled, CLEKS_ON_ERROR_PARTIAL, &error);
+    expect(error.code == CLEKS_OK && tokens != NULL && tokens->size == 3, "escaped utf-8: valid");
+    if (tokens != NULL && tokens->size == 3){
+        expect(strcmp(tokens->items[0].value, "\xc3\xa9") == 0, "escaped utf-8: value");
+        expect(strcmp(tokens->items[2].value, "a\xf0\x9f\x98\x80" "b") == 0, "escaped utf-8: value of 4 bytes");
+    }
+    Cleks_free_tokens(tokens);
+    // the escaped sequence is still validated
+    char invalid[] = "\"\\\xc3\x28\"";
+    tokens = Cleks_lex_checked(invalid, strlen(invalid), compiled, CLEKS_ON_ERROR_PARTIAL, &error);
+    expect(error.code == CLEKS_ERROR_INVALID_UTF8 && error.offset == 2, "escaped utf-8: invalid");
+    Cleks_free_tokens(tokens);
+    Cleks_free_compiled_config(compiled);
+}
+
+static void test_float_locale(void)
+{
+    // numbers with more than 19 significant digits are parsed by strtod
+    char buffer[] = "3.14159265358979323846264338";
+    double expected = strtod("3.14159265358979323846264338", NULL);
+    // the test is skipped where none of these locales is installed
+    const char *locales[] = {"de_DE.UTF-8", "fr_FR.UTF-8", "ps_AF.UTF-8", "de_DE", "fr_FR"};
+    for (size_t i=0; i<CLEKS_ARR_LEN(locales); ++i){
+        if (setlocale(LC_NUMERIC, locales[i]) == NULL) continue;
+        CleksTokens *tokens = Cleks_lex(buffer, strlen(buffer), JsonConfig);
+        bool same = tokens != NULL && tokens->size == 1 && tokens->items[0].type == CLEKS_FLOAT && tokens->items[0].float_value == expected;
+        expect(same, "float locale");
+        Cleks_free_tokens(tokens);
+    }
+    setlocale(LC_NUMERIC, "C");
+}
+
+typedef struct{
+    const char *buffer;
+    size_t size;
+    size_t position;
+} TestSource;
+
+static size_t read_source(void *user, char *buffer, size_t size)
+{
+    TestSource *source = (TestSource*) user;
+    size_t n = source->size - source->position;
+    if (n > size) n = size;
+    memcpy(buffer, source->buffer + source->position, n);
+    source->position += n;
+    return n;
+}
+
+static void test_stream_long_string(void)
+{
+    // rescanning the string from its start after every chunk would take hours
+    const char piece[] = "ab\\u00e9\xc3\xa9";
+    const char unescaped[] = "ab\xc3\xa9\xc3\xa9";
+    size_t piece_len = strlen(piece), unescaped_len = strlen(unescaped), count = 1 << 17;
+    size_t size = count * piece_len + 2;
+    char *buffer = (char*) malloc(size);
+    buffer[0] = '"';
+    for (size_t i=0; i<count; ++i) memcpy(buffer + 1 + i * piece_len, piece, piece_len);
+    buffer[size-1] = '"';
+    CleksCompiledConfig *compiled = Cleks_compile_config(JsonConfig);
+    TestSource source = {.buffer=buffer, .size=size, .position=0};
+    // the chunk boundaries fall into every position of the escapes and UTF-8 sequences
+    CleksStream *stream = Cleks_create_stream(compiled, read_source, &source, 7);
+    CleksToken token;
+    bool found = Cleks_next_token(stream, &token);
+    expect(found && token.type == CLEKS_STRING && token.offset == 1 && token.length == size - 2, "stream long string: token");
+    if (found){
+        bool same = strlen(token.value) == count * unescaped_len;
+        for (size_t i=0; same && i<count; ++i) same = memcmp(token.value + i * unescaped_len, unescaped, unescaped_len) == 0;
+        expect(same, "stream long string: value");
+        Cleks_free(NULL, token.value);
+    }
+    expect(!Cleks_next_token(stream, &token) && stream->error.code == CLEKS_OK, "stream long string: end");
+    Cleks_free_stream(stream);
+    Cleks_free_compiled_config(compiled);
+    free(buffer);
+}
+
+int main(void)
+{
+    test_load_corrupted_length();
+    test_escaped_utf8();
+    test_stream_long_string();
+    test_float_locale();
+    printf("%s\n", failures == 0 ? "all cases passed" : "some cases failed");
+    return failures == 0 ? 0 : 1;
+}
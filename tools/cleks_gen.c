@@ -0,0 +1,251 @@
+/*
+    Generates a lexer specialized for a cleks config (see Cleks_generate).
+
+    Build and run from the repository root:
+        cc -O2 -o tools/cleks_gen tools/cleks_gen.c -lm -lpthread
+        ./tools/cleks_gen json json > json_lexer.h
+
+    The generated header defines json_lex and json_lex_checked, which return the same tokens as
+    Cleks_lex and Cleks_lex_checked with JsonConfig. It includes "cleks.h" unless cleks.h was included before.
+
+    Configs of other headers are added by building with:
+        -DCLEKS_GEN_TEMPLATE='"path/to/template.h"' -DCLEKS_GEN_CONFIG=MyConfig
+    and are called "custom" on the command line.
+
+    Differential testing of a generated lexer against the interpreted one:
+        cc -O2 -I. -DCLEKS_GEN_VERIFY='"json_lexer.h"' -DCLEKS_GEN_PREFIX=json -o tools/cleks_verify tools/cleks_gen.c -lm -lpthread
+        ./tools/cleks_verify json [<file>...]
+    This compares the tokens and errors of both lexers on random inputs made of the config's characters
+    and on the given files, and reports the throughput of both on the files.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../cleks.h"
+#include "../templates/cleks_json_template.h"
+#include "../templates/cleks_brainfuck_template.h"
+#ifdef CLEKS_GEN_TEMPLATE
+#include CLEKS_GEN_TEMPLATE
+#endif // CLEKS_GEN_TEMPLATE
+
+typedef struct{
+    const char *name;
+    CleksConfig *config;
+} GenTemplate;
+
+static GenTemplate templates[] = {
+    {"json", &JsonConfig},
+    {"brainfuck", &BrainfuckConfig},
+#ifdef CLEKS_GEN_CONFIG
+    {"custom", &CLEKS_GEN_CONFIG},
+#endif // CLEKS_GEN_CONFIG
+};
+
+static CleksConfig* find_template(const char *name)
+{
+    for (size_t i=0; i<CLEKS_ARR_LEN(templates); ++i){
+        if (strcmp(templates[i].name, name) == 0) return templates[i].config;
+    }
+    fprintf(stderr, "Unknown config '%s', available:", name);
+    for (size_t i=0; i<CLEKS_ARR_LEN(templates); ++i) fprintf(stderr, " %s", templates[i].name);
+    fputc('\n', stderr);
+    return NULL;
+}
+
+#ifdef CLEKS_GEN_VERIFY
+
+#include CLEKS_GEN_VERIFY
+
+#define GEN_CONCAT(a, b) a ## b
+#define GEN_NAME(prefix, name) GEN_CONCAT(prefix, name)
+#define gen_lex_checked GEN_NAME(CLEKS_GEN_PREFIX, _lex_checked)
+
+#define VERIFY_RUNS 200000
+#define VERIFY_MAX_LENGTH 96
+
+static uint64_t verify_state = 0x853c49e6748fea9bULL;
+
+static uint64_t verify_random(void)
+{
+    // xorshift64
+    verify_state ^= verify_state << 13;
+    verify_state ^= verify_state >> 7;
+    verify_state ^= verify_state << 17;
+    return verify_state;
+}
+
+static void add_chars(char *alphabet, size_t *size, const char *chars)
+{
+    for (; chars != NULL && *chars != '\0'; ++chars){
+        if (memchr(alphabet, *chars, *size) == NULL && *size < 256) alphabet[(*size)++] = *chars;
+    }
+}
+
+// the characters that change what the lexer does, and some that do not
+static size_t build_alphabet(CleksConfig config, char *alphabet)
+{
+    size_t size = 0;
+    add_chars(alphabet, &size, "09.-+eEax\\\n ");
+    // \uXXXX escapes, surrogates and UTF-8 sequences for the string validation flags
+    add_chars(alphabet, &size, "uDdF\xc3\xa9\xed\xa0\xf0\x9f\xff");
+    add_chars(alphabet, &size, config.whitespaces);
+    for (size_t i=0; i<config.custom_token_count; ++i){
+        char symbol[2] = {config.custom_tokens[i].symbol, '\0'};
+        add_chars(alphabet, &size, symbol);
+        add_chars(alphabet, &size, config.custom_tokens[i].word);
+        add_chars(alphabet, &size, config.custom_tokens[i].long_symbol);
+    }
+    for (size_t i=0; i<config.string_count; ++i){
+        char dels[3] = {config.strings[i].start_del, config.strings[i].end_del, '\0'};
+        add_chars(alphabet, &size, dels);
+    }
+    for (size_t i=0; i<config.comment_count; ++i){
+        add_chars(alphabet, &size, config.comments[i].start_del);
+        add_chars(alphabet, &size, config.comments[i].end_del);
+    }
+    return size;
+}
+
+static bool same_token(CleksToken *a, CleksToken *b)
+{
+    if (a->type != b->type || a->offset != b->offset || a->length != b->length || a->flags != b->flags) return false;
+    if ((a->value == NULL) != (b->value == NULL)) return false;
+    if (a->value != NULL && strcmp(a->value, b->value) != 0) return false;
+    if (a->type == CLEKS_INT && a->int_value != b->int_value) return false;
+    if (a->type == CLEKS_FLOAT && memcmp(&a->float_value, &b->float_value, sizeof(double)) != 0) return false;
+    return true;
+}
+
+// returns the index of the first differing token, -1 if the results are the same
+static long compare(CleksTokens *expected, CleksError *expected_error, CleksTokens *actual, CleksError *actual_error)
+{
+    if ((expected == NULL) != (actual == NULL)) return 0;
+    if (memcmp(expected_error, actual_error, sizeof(CleksError)) != 0) return 0;
+    if (expected == NULL) return -1;
+    if (expected->clean_size != actual->clean_size || expected->error_code != actual->error_code) return 0;
+    if (expected->error_count != actual->error_count || expected->error_end != actual->error_end) return 0;
+    size_t size = expected->size < actual->size ? expected->size : actual->size;
+    for (size_t i=0; i<size; ++i){
+        if (!same_token(&expected->items[i], &actual->items[i])) return (long) i;
+    }
+    return expected->size != actual->size ? (long) size : -1;
+}
+
+static bool verify(char *buffer, size_t size, CleksCompiledConfig *compiled, const char *name)
+{
+    static const CleksErrorPolicy policies[] = {CLEKS_ON_ERROR_FREE, CLEKS_ON_ERROR_PARTIAL, CLEKS_ON_ERROR_RECOVER};
+    for (size_t i=0; i<CLEKS_ARR_LEN(policies); ++i){
+        CleksError expected_error, actual_error;
+        CleksTokens *expected = Cleks_lex_checked(buffer, size, compiled, policies[i], &expected_error);
+        CleksTokens *actual = gen_lex_checked(buffer, size, policies[i], &actual_error);
+        long diff = compare(expected, &expected_error, actual, &actual_error);
+        if (diff >= 0){
+            printf("MISMATCH in %s (policy %zu) at token %ld:\n%.*s\n", name, i, diff, (int) size, buffer);
+            printf("expected (error %s at %zu):\n", Cleks_error_to_string(expected_error.code), expected_error.offset);
+            if (expected != NULL) Cleks_print_tokens(expected);
+            printf("actual (error %s at %zu):\n", Cleks_error_to_string(actual_error.code), actual_error.offset);
+            if (actual != NULL) Cleks_print_tokens(actual);
+        }
+        Cleks_free_tokens(expected);
+        Cleks_free_tokens(actual);
+        if (diff >= 0) return false;
+    }
+    return true;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static char* read_file(const char *path, size_t *size)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+    fseek(file, 0, SEEK_END);
+    *size = (size_t) ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *buffer = (char*) malloc(*size + 1);
+    if (buffer != NULL && fread(buffer, 1, *size, file) != *size){
+        free(buffer);
+        buffer = NULL;
+    }
+    fclose(file);
+    return buffer;
+}
+
+static void throughput(char *buffer, size_t size, CleksCompiledConfig *compiled, const char *path)
+{
+    double interpreted = 0, generated = 0;
+    for (int run=0; run<5; ++run){
+        double start = now();
+        Cleks_free_tokens(Cleks_lex_checked(buffer, size, compiled, CLEKS_ON_ERROR_PARTIAL, NULL));
+        double middle = now();
+        Cleks_free_tokens(gen_lex_checked(buffer, size, CLEKS_ON_ERROR_PARTIAL, NULL));
+        double stop = now();
+        if (run == 0 || middle - start < interpreted) interpreted = middle - start;
+        if (run == 0 || stop - middle < generated) generated = stop - middle;
+    }
+    printf("%s: interpreted %.1f MB/s, generated %.1f MB/s\n", path, size/interpreted/1e6, size/generated/1e6);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2){
+        fprintf(stderr, "Usage: %s <config> [<file>...]\n", argv[0]);
+        return 1;
+    }
+    CleksConfig *config = find_template(argv[1]);
+    if (config == NULL) return 1;
+    CleksCompiledConfig *compiled = Cleks_compile_config(*config);
+    if (compiled == NULL) return 1;
+    char alphabet[256];
+    size_t alphabet_size = build_alphabet(*config, alphabet);
+    char buffer[VERIFY_MAX_LENGTH];
+    size_t failures = 0;
+    for (size_t run=0; run<VERIFY_RUNS && failures < 10; ++run){
+        size_t size = verify_random() % (VERIFY_MAX_LENGTH+1);
+        for (size_t i=0; i<size; ++i) buffer[i] = alphabet[verify_random() % alphabet_size];
+        if (!verify(buffer, size, compiled, "random input")) failures += 1;
+    }
+    printf("%d random inputs: %zu mismatches\n", VERIFY_RUNS, failures);
+    for (int i=2; i<argc; ++i){
+        size_t size;
+        char *file = read_file(argv[i], &size);
+        if (file == NULL){
+            fprintf(stderr, "Failed to read '%s'!\n", argv[i]);
+            failures += 1;
+            continue;
+        }
+        if (verify(file, size, compiled, argv[i])) throughput(file, size, compiled, argv[i]);
+        else failures += 1;
+        free(file);
+    }
+    Cleks_free_compiled_config(compiled);
+    return failures == 0 ? 0 : 1;
+}
+
+#else
+
+int main(int argc, char **argv)
+{
+    if (argc < 3){
+        fprintf(stderr, "Usage: %s <config> <prefix> [<output>]\n", argv[0]);
+        return 1;
+    }
+    CleksConfig *config = find_template(argv[1]);
+    if (config == NULL) return 1;
+    FILE *out = argc > 3 ? fopen(argv[3], "w") : stdout;
+    if (out == NULL){
+        fprintf(stderr, "Failed to open '%s'!\n", argv[3]);
+        return 1;
+    }
+    bool generated = Cleks_generate(out, *config, argv[2]);
+    if (out != stdout) fclose(out);
+    return generated ? 0 : 1;
+}
+
+#endif // CLEKS_GEN_VERIFY
\ No newline at end of file